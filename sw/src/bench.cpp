@@ -0,0 +1,440 @@
+// -------------------------------------------------------------------------
+// Microbenchmarks of pistackmond hot paths
+//
+// Runs on any machine, no PiStackMon or GPIO access needed.
+// LED driver routines are linked against a plain memory block standing in
+// for GPIO registers (gpio_BENCH.h), unless built for another platform
+// (make bench BENCH_PLATFORM=...).
+// Built as bench_pwm (BENCH_PWM), it runs against the simulated GPIO of
+// gpio_SIM.h instead, which emulates the LED driver chain, and checks BCM
+// timing of the PWM thread against duty cycles of a test frame.
+//
+// usage: bench [-j]
+//        bench_pwm [-j]
+// -j prints results as JSON lines, one object per benchmark
+//
+// Website: https://github.com/tomek-szczesny/pistackmon
+// Authors: Tomek Szczesny, Bernhard Bablok
+// License: GPL3
+// -------------------------------------------------------------------------
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string>
+#include <thread>
+
+#include <fcntl.h>			// open()
+#include <unistd.h>			// access(), syscall()
+#include <sys/ioctl.h>			// ioctl()
+#include <sys/syscall.h>		// SYS_perf_event_open
+#include <sys/utsname.h>		// uname()
+#include <linux/perf_event.h>
+
+#include "config.h"
+#include "metrics.h"
+#include "render.h"
+#include "pwm.h"
+#include "driver.h"
+
+using namespace std::chrono_literals;
+
+// Keeps the compiler from optimizing benchmarked code away
+volatile uint32_t sink;
+
+bool json = false;
+
+const char *thermal = "/sys/devices/virtual/thermal/thermal_zone0/temp";
+
+//============================== ALLOCATION COUNTER ============================
+
+std::atomic<long> allocations(0);
+
+void *operator new(size_t size) {
+	allocations.fetch_add(1, std::memory_order_relaxed);
+	void *p = std::malloc(size ? size : 1);
+	if (!p) throw std::bad_alloc();
+	return p;
+}
+
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete(void *p, size_t) noexcept { std::free(p); }
+
+//============================== CACHE MISS COUNTER ============================
+
+int perfOpen() {
+	// Opens a cache miss counter for this thread, or returns -1.
+	// Kernel side is counted as well where perf_event_paranoid allows that,
+	// since sampling functions spend most of their time in syscalls.
+
+	perf_event_attr attr;
+	std::memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.config = PERF_COUNT_HW_CACHE_MISSES;
+	attr.disabled = 1;
+	attr.exclude_hv = 1;
+
+	for (int exclude_kernel = 0; exclude_kernel < 2; exclude_kernel++) {
+		attr.exclude_kernel = exclude_kernel;
+		int fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+		if (fd != -1) return fd;
+	}
+	return -1;
+}
+
+int perf_fd = -1;
+
+//================================== HARNESS ===================================
+
+template <typename F>
+void bench(const char *name, long iterations, F f) {
+	// Runs f() a given number of times and reports mean time,
+	// heap allocations and cache misses per call
+
+	for (long i = 0; i < iterations / 10; i++) f(i);	// warm up
+
+	long allocs = allocations.load();
+	if (perf_fd != -1) {
+		ioctl(perf_fd, PERF_EVENT_IOC_RESET, 0);
+		ioctl(perf_fd, PERF_EVENT_IOC_ENABLE, 0);
+	}
+	auto start = std::chrono::steady_clock::now();
+	for (long i = 0; i < iterations; i++) f(i);
+	auto end = std::chrono::steady_clock::now();
+	uint64_t misses = 0;
+	if (perf_fd != -1) {
+		ioctl(perf_fd, PERF_EVENT_IOC_DISABLE, 0);
+		if (read(perf_fd, &misses, sizeof(misses)) != sizeof(misses))
+			misses = 0;
+	}
+	allocs = allocations.load() - allocs;
+
+	double ns = std::chrono::duration<double, std::nano>(end - start).count();
+	ns /= iterations;
+	double allocs_op = static_cast<double>(allocs) / iterations;
+	double misses_op = static_cast<double>(misses) / iterations;
+
+	if (json) {
+		std::printf("{\"name\":\"%s\",\"iterations\":%ld,\"ns_per_op\":%.2f,"
+			    "\"allocs_per_op\":%.2f,\"cache_misses_per_op\":",
+			    name, iterations, ns, allocs_op);
+		if (perf_fd != -1) std::printf("%.3f}\n", misses_op);
+		else               std::printf("null}\n");
+	} else {
+		std::printf("%-24s %12.1f ns/op %8.2f allocs/op", name, ns, allocs_op);
+		if (perf_fd != -1) std::printf(" %10.3f misses/op", misses_op);
+		std::printf("\n");
+	}
+}
+
+//  -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -
+
+void header() {
+	// Describes the machine, so results from different boards
+	// may be told apart
+
+	utsname u;
+	uname(&u);
+	if (json) {
+		std::printf("{\"machine\":\"%s\",\"kernel\":\"%s\",\"compiler\":\"%s\","
+			    "\"gpio\":\"%s\",\"chain\":%d,\"cache_misses\":%s}\n",
+			    u.machine, u.release, __VERSION__, GPIO_HEADER, CHAIN_WIDTH,
+			    perf_fd != -1 ? "true" : "false");
+	} else {
+		std::printf("# %s, Linux %s, %s, %s, chain %d%s\n", u.machine,
+			    u.release, __VERSION__, GPIO_HEADER, CHAIN_WIDTH,
+			    perf_fd != -1 ? "" :
+			    ", cache misses not available");
+	}
+}
+
+//================================= STARTUP ====================================
+
+void startup(const Config &c) {
+	// Measures time to the first frame, going through the same steps
+	// as the daemon does: first readings, params, first frame, then
+	// the PWM thread up to its first latch.
+	// Must run before anything else calls fetchCpu().
+
+	auto start = std::chrono::steady_clock::now();
+	bar_fills_datatype fills = {};
+	fills[BAR_CPU] = fetchCpu() / 100;
+	fills[BAR_RAM] = fetchRam() / 100;
+	fills[BAR_TEMP] = access(thermal, R_OK) == 0 ? (fetchTemp() - 40) / 50 : 0;
+	PwmParams *p = buildPwmParams(c);
+	publishFrame(format_pwms<CHAIN_WIDTH>(led_pwms(*p, fills, 0)), p);
+	pwm_closing = 0;
+	std::thread pwm_thread(PWM);
+	while (!pwm_first_frame) std::this_thread::yield();
+	auto first = std::chrono::steady_clock::time_point(
+			std::chrono::steady_clock::duration(pwm_first_frame.load()));
+	pwm_closing = 1;
+	pwm_thread.join();
+	delete p;
+
+	double ms = std::chrono::duration<double, std::milli>(first - start).count();
+	if (json) {
+		std::printf("{\"name\":\"time_to_first_frame\",\"ms\":%.3f}\n", ms);
+	} else {
+		std::printf("%-24s %12.3f ms\n", "time_to_first_frame", ms);
+	}
+}
+
+//================================= SAMPLING ===================================
+
+void sampling(const char *engine, int n) {
+	// Reads n metric files per tick, as the daemon does on every sample:
+	// opened, read and closed each time (as fetchCpu() and alike do),
+	// kept open and read with pread(), or read in one io_uring submission.
+	// Files readable here are repeated to make up larger sets.
+	// CPU time includes io_uring workers, being threads of this process.
+
+	const char *candidates[] = {"/proc/stat", "/proc/meminfo", thermal,
+				    "/proc/diskstats", "/proc/net/dev",
+				    "/proc/loadavg", "/proc/uptime"};
+	std::vector<std::string> paths;
+	for (auto f : candidates) {
+		if (access(f, R_OK) == 0) paths.push_back(f);
+	}
+	const bool plain = std::strcmp(engine, "open/read/close") == 0;
+	Sampler sampler;
+	if (!plain) {
+		std::string err;
+		if (!sampler.open(std::strcmp(engine, "io_uring") == 0, err)) {
+			if (!json) std::printf("%-24s not available: %s\n", engine, err.c_str());
+			return;
+		}
+		for (int i = 0; i < n; i++) sampler.add(paths[i % paths.size()]);
+		sampler.read();		// registers files, sizes buffers
+	}
+
+	const int ticks = 2000;
+	static char buf[16384];
+	uint64_t calls = sampler.syscalls();
+	timespec cpu0, cpu1;
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu0);
+	auto start = std::chrono::steady_clock::now();
+	for (int t = 0; t < ticks; t++) {
+		if (!plain) {
+			sampler.read();
+			sink = *sampler.data(0);
+			continue;
+		}
+		for (int i = 0; i < n; i++) {
+			int fd = open(paths[i % paths.size()].c_str(), O_RDONLY | O_CLOEXEC);
+			if (fd == -1) continue;
+			sink = read(fd, buf, sizeof(buf));
+			close(fd);
+		}
+	}
+	auto end = std::chrono::steady_clock::now();
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu1);
+
+	double us = std::chrono::duration<double, std::micro>(end - start).count() / ticks;
+	double cpu_us = ((cpu1.tv_sec - cpu0.tv_sec) * 1e6 +
+			 (cpu1.tv_nsec - cpu0.tv_nsec) / 1e3) / ticks;
+	double syscalls = plain ? 3.0 * n :
+			  static_cast<double>(sampler.syscalls() - calls) / ticks;
+
+	if (json) {
+		std::printf("{\"name\":\"sampling\",\"engine\":\"%s\",\"files\":%d,"
+			    "\"syscalls_per_tick\":%.2f,\"cpu_us_per_tick\":%.2f,"
+			    "\"us_per_tick\":%.2f}\n", engine, n, syscalls, cpu_us, us);
+	} else {
+		std::printf("%-24s %2d files %6.1f syscalls/tick %8.1f us cpu/tick "
+			    "%8.1f us/tick\n", engine, n, syscalls, cpu_us, us);
+	}
+}
+
+//============================= BCM TIMING CHECK ===============================
+
+#ifdef BENCH_PWM
+void pwmDuty(const char *name, const Config &c, bool saturated) {
+	// Runs the PWM thread on a test frame for a second, and compares
+	// the time each emulated driver output has been lit with its duty cycle.
+	// Errors are in % of full scale. Late slots (no real time priority here)
+	// and sleep overshoot show up as errors.
+	// A saturated frame has all but one LED dark or fully lit, as most
+	// are, which leaves bitplanes to be merged and shifts to be avoided.
+	// The supervisor is off, as a fallback to static LEDs would only
+	// hide these errors.
+
+	Config pc = c;
+	pc.fallback = 0;
+	PwmParams *p = buildPwmParams(pc);
+	const int full = (1 << c.pwm_res) - 1;
+	led_duties_datatype duties;
+	for (int i = 0; i < CHAIN_WIDTH; i++) {
+		duties[i] = saturated ? (i % 3 ? 0 : full) : (i * 37 + 5) % (full + 1);
+	}
+	if (saturated) duties[1] = full / 2;
+
+	publishFrame(format_pwms<CHAIN_WIDTH>(duties), p);
+	pwm_closing = 0;
+	std::thread pwm_thread(PWM);
+	std::this_thread::sleep_for(200ms);
+	simReset();
+	uint64_t slots = pwm_slots.load();
+	uint64_t late = pwm_late_slots.load();
+	uint64_t avoided = pwm_shifts_avoided.load();
+	std::this_thread::sleep_for(1s);
+	SimChain chain = simChain();
+	slots = pwm_slots.load() - slots;
+	late = pwm_late_slots.load() - late;
+	avoided = pwm_shifts_avoided.load() - avoided;
+	pwm_closing = 1;
+	pwm_thread.join();
+	delete p;
+
+	double max_err = 0, sum_err = 0;
+	for (int i = 0; i < CHAIN_WIDTH; i++) {
+		double expected = static_cast<double>(duties[i]) / full * c.brightness;
+		double err = std::fabs(chain.lit[i] / chain.elapsed - expected) * 100;
+		max_err = std::max(max_err, err);
+		sum_err += err;
+	}
+	double bits = chain.latches ? static_cast<double>(chain.clocks) / chain.latches : 0;
+	double late_pct = slots ? 100.0 * late / slots : 0;
+
+	if (json) {
+		std::printf("{\"name\":\"%s\",\"chain\":%d,\"bits_per_latch\":%.2f,"
+			    "\"max_error\":%.3f,\"mean_error\":%.3f,\"late_slots\":%.2f,"
+			    "\"shifts_avoided\":%.0f}\n",
+			    name, CHAIN_WIDTH, bits, max_err, sum_err / CHAIN_WIDTH, late_pct,
+			    avoided / chain.elapsed);
+	} else {
+		std::printf("%-24s chain %d, %.1f bits/latch, duty error max %.3f%% "
+			    "mean %.3f%%, %.2f%% late slots, %.0f shifts avoided/s\n",
+			    name, CHAIN_WIDTH, bits, max_err, sum_err / CHAIN_WIDTH,
+			    late_pct, avoided / chain.elapsed);
+	}
+}
+#endif
+
+// =================================== MAIN ====================================
+
+int main(int argc, char *argv[]) {
+	if (argc > 1 && std::string(argv[1]) == "-j") json = true;
+
+	perf_fd = perfOpen();
+	header();
+
+	Config cfg;
+#ifdef BENCH_PWM
+	// BCM timing, with and without brightness gating
+	pwmDuty("pwm_duty", cfg, false);
+	pwmDuty("pwm_duty (saturated)", cfg, true);
+	Config dim = cfg;
+	dim.brightness = 0.5;
+	pwmDuty("pwm_duty (gated)", dim, false);
+	pwmDuty("pwm_duty (gated, sat.)", dim, true);
+#else
+	startup(cfg);
+	PwmParams *p = buildPwmParams(cfg);
+
+	// Data sources
+	// fetchCpu() returns the previous result when no ticks have elapsed,
+	// which is the case for most calls here. File access and parsing
+	// are done every time anyway.
+	bench("fetchCpu", 20000, [&](long) { sink = fetchCpu(); });
+	bench("fetchRam", 20000, [&](long) { sink = fetchRam(); });
+	if (access(thermal, R_OK) == 0)
+		bench("fetchTemp", 20000, [&](long) { sink = fetchTemp(); });
+	CpuFreq cpufreq;
+	if (cpufreq.open()) {
+		bench("cpufreq", 20000, [&](long) {
+			sink = cpufreq.capacity() * 1000 + cpufreq.throttled();
+		});
+	}
+	cpufreq.close();
+
+	// I/O rates, over devices and interfaces that may be there
+	DiskStats disks;
+	if (disks.open("/proc/diskstats", {"mmcblk0", "sda", "vda"})) {
+		bench("diskstats", 20000, [&](long) {
+			sink = disks.sample(std::chrono::steady_clock::now())[0];
+		});
+	}
+	disks.close();
+	NetDev nets;
+	if (nets.open("/proc/net/dev", {"lo", "eth0"})) {
+		bench("net_dev", 20000, [&](long) {
+			sink = nets.sample(std::chrono::steady_clock::now())[0];
+		});
+	}
+	nets.close();
+
+	// Performance counter groups, one read() per CPU
+	PerfCounters perf;
+	std::string perf_err;
+	if (perf.open(perf_err)) {
+		bench(perf.hardware() ? "perf (hardware)" : "perf (software)", 20000,
+		      [&](long) {
+			sink = perf.sample(std::chrono::steady_clock::now())[2];
+		});
+	}
+	perf.close();
+
+	// Reading all files of a sample, as more sources are added
+	for (const char *engine : {"open/read/close", "pread", "io_uring"}) {
+		for (int n : {3, 10, 20, 30}) sampling(engine, n);
+	}
+
+	// Rendering, sweeping through values so no LED stays saturated
+	bar_fills_datatype fills;
+	auto sweep = [&](long i) {
+		float v = i % 1000 * 0.001f;
+		for (int b = 0; b < BARS; b++) fills[b] = b & 1 ? 1 - v : v;
+		return v;
+	};
+	bench("led_pwms", 2000000, [&](long i) {
+		float v = sweep(i);
+		led_duties_datatype d = led_pwms(*p, fills, v);
+		sink = d[i & 15];
+	});
+
+	led_duties_datatype duties;
+	for (int i = 0; i < CHAIN_WIDTH; i++) duties[i] = i * 4099;
+	bench("format_pwms", 2000000, [&](long i) {
+		duties[i % CHAIN_WIDTH] ^= i;
+		pwm_data_datatype planes = format_pwms<CHAIN_WIDTH>(duties);
+		sink = planes[i & 15];
+	});
+
+	bench("render (both)", 2000000, [&](long i) {
+		float v = sweep(i);
+		pwm_data_datatype planes = format_pwms<CHAIN_WIDTH>(
+				led_pwms(*p, fills, v));
+		sink = planes[i & 15];
+	});
+
+	bench("render+schedule", 2000000, [&](long i) {
+		float v = sweep(i);
+		pwm_schedule_datatype s = compactSchedule(*p, format_pwms<CHAIN_WIDTH>(
+				led_pwms(*p, fills, v)));
+		sink = s.slots;
+	});
+
+	// LED driver
+	gpioInit();
+	bench("sendFrame", 100000, [&](long i) {
+		sendFrame<CHAIN_WIDTH>(i * 0x9E3779B97F4A7C15ull);
+	});
+	bench("sendFrame+commit", 100000, [&](long i) {
+		sendFrame<CHAIN_WIDTH>(i * 0x9E3779B97F4A7C15ull);
+		commitFrame();
+	});
+	gpioDeinit();
+	delete p;
+#endif
+
+	if (perf_fd != -1) close(perf_fd);
+	return 0;
+}
@@ -0,0 +1,30 @@
+// -------------------------------------------------------------------------
+// Clock
+//
+// clock.cpp: time source of pistackmond threads, real or simulated
+//
+// Website: https://github.com/tomek-szczesny/pistackmon
+// Authors: Tomek Szczesny, Bernhard Bablok
+// License: GPL3
+// -------------------------------------------------------------------------
+
+#include <thread>
+
+#include "clock.h"
+
+static RealClock real_clock;
+Clock *clk = &real_clock;
+
+//  -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -
+
+Clock::time_point RealClock::now() {
+	return std::chrono::steady_clock::now();
+}
+
+void RealClock::sleepUntil(time_point t) {
+	std::this_thread::sleep_until(t);
+}
+
+void RealClock::spinUntil(time_point t) {
+	while (std::chrono::steady_clock::now() < t) {}
+}
@@ -0,0 +1,54 @@
+// -------------------------------------------------------------------------
+// Clock
+//
+// clock.h: time source of pistackmond threads, real or simulated
+//
+// Website: https://github.com/tomek-szczesny/pistackmon
+// Authors: Tomek Szczesny, Bernhard Bablok
+// License: GPL3
+// -------------------------------------------------------------------------
+
+#ifndef _CLOCK_H
+#define _CLOCK_H
+
+#include <chrono>
+
+class Clock {
+	// Both threads tell time and sleep through a Clock only, so the
+	// whole daemon may run on simulated time (see sim.cpp).
+	// Threads taking part in simulated time announce themselves:
+	// the creating thread calls expect(), the new one enter() first and
+	// leave() last. A real clock ignores these.
+
+	public:
+	typedef std::chrono::steady_clock::time_point time_point;
+	typedef std::chrono::steady_clock::duration duration;
+
+	virtual ~Clock() {}
+
+	virtual time_point now() = 0;
+	virtual void sleepUntil(time_point t) = 0;
+
+	// Waits for a moment too close for a thread to wake up accurately
+	virtual void spinUntil(time_point t) = 0;
+
+	virtual bool simulated() const { return false; }
+
+	virtual void expect() {}
+	virtual void enter() {}
+	virtual void leave() {}
+
+	void sleepFor(duration d) { sleepUntil(now() + d); }
+};
+
+class RealClock : public Clock {
+	public:
+	time_point now() override;
+	void sleepUntil(time_point t) override;
+	void spinUntil(time_point t) override;
+};
+
+// Clock in use, the real one unless replaced before threads are started
+extern Clock *clk;
+
+#endif
@@ -0,0 +1,284 @@
+// -------------------------------------------------------------------------
+// Runtime configuration
+//
+// config.cpp: config file parser and validation
+//
+// Website: https://github.com/tomek-szczesny/pistackmon
+// Authors: Tomek Szczesny, Bernhard Bablok
+// License: GPL3
+// -------------------------------------------------------------------------
+
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#include "config.h"
+
+// Every key known to the config file, along with its accepted range.
+// Only one of the member pointers is set for each key.
+// Strings have no range, they are checked by validateConfig().
+struct ConfigKey {
+	const char *name;
+	float Config::*f;
+	int Config::*i;
+	double min;
+	double max;
+	std::string Config::*s = nullptr;
+};
+
+// Names of sources, in the order of enum Source
+static const char *source_names[SOURCES] = {
+	"none", "cpu", "ram", "temp", "disk", "disk_iops", "net", "net_rx", "net_tx",
+	"ipc", "mpki", "faults", "cpu_noio", "iowait", "irq", "steal", "cpu_split"
+};
+
+static const ConfigKey config_keys[] = {
+	{"refresh_rate",   &Config::refresh_rate,   nullptr,           0.1, 1000},
+	{"ref_div",        nullptr,                 &Config::ref_div,  1,   1000},
+	{"pwm_lsb_period", &Config::pwm_lsb_period, nullptr,           1,   100000},
+	{"pwm_res",        nullptr,                 &Config::pwm_res,  2,   16},
+	{"led_g",          &Config::led_g,          nullptr,           0,   1},
+	{"led_y",          &Config::led_y,          nullptr,           0,   1},
+	{"led_r",          &Config::led_r,          nullptr,           0,   1},
+	{"led_b",          &Config::led_b,          nullptr,           0,   1},
+	{"led_ext",        &Config::led_ext,        nullptr,           0,   1},
+	{"led_gamma",      &Config::led_gamma,      nullptr,           0.01, 20},
+	{"brightness",     &Config::brightness,     nullptr,           0,   1},
+	{"cpu_freq_scale",      nullptr, &Config::cpu_freq_scale,  0, 1},
+	{"cpu_split_dim",       &Config::cpu_split_dim,       nullptr, 0, 1},
+	{"bar_cpu",             nullptr, nullptr, 0, 0, &Config::bar_cpu},
+	{"bar_ram",             nullptr, nullptr, 0, 0, &Config::bar_ram},
+	{"bar_temp",            nullptr, nullptr, 0, 0, &Config::bar_temp},
+	{"bar_ext",             nullptr, nullptr, 0, 0, &Config::bar_ext},
+	{"disk_devices",        nullptr, nullptr, 0, 0, &Config::disk_devices},
+	{"net_interfaces",      nullptr, nullptr, 0, 0, &Config::net_interfaces},
+	{"disk_full_scale",     &Config::disk_full_scale,     nullptr, 1, 1e12},
+	{"disk_iops_full_scale",&Config::disk_iops_full_scale,nullptr, 1, 1e9},
+	{"net_full_scale",      &Config::net_full_scale,      nullptr, 1, 1e12},
+	{"perf_counters",       nullptr, &Config::perf_counters,   0, 1},
+	{"ipc_full_scale",      &Config::ipc_full_scale,      nullptr, 0.1, 100},
+	{"mpki_full_scale",     &Config::mpki_full_scale,     nullptr, 0.1, 1000},
+	{"faults_full_scale",   &Config::faults_full_scale,   nullptr, 1, 1e9},
+	{"adaptive_sampling",   nullptr, &Config::adaptive_sampling, 0, 1},
+	{"sample_min_rate",     &Config::sample_min_rate,     nullptr, 0.01, 1000},
+	{"sample_dead_band",    &Config::sample_dead_band,    nullptr, 0, 100},
+	{"sample_jump",         &Config::sample_jump,         nullptr, 0, 100},
+	{"sample_psi",          nullptr, nullptr, 0, 0, &Config::sample_psi},
+	{"io_uring",            nullptr, &Config::io_uring,        0, 1},
+	{"governor",            nullptr, &Config::governor,        0, 1},
+	{"gov_max_level",       nullptr, &Config::gov_max_level,   0, 14},
+	{"gov_min_pwm_res",     nullptr, &Config::gov_min_pwm_res, 2, 16},
+	{"gov_min_cycle_rate",  &Config::gov_min_cycle_rate,  nullptr, 1, 10000},
+	{"gov_min_sample_rate", &Config::gov_min_sample_rate, nullptr, 0.01, 1000},
+	{"gov_cpu_high",        &Config::gov_cpu_high,        nullptr, 0, 100},
+	{"gov_cpu_low",         &Config::gov_cpu_low,         nullptr, 0, 100},
+	{"gov_temp_high",       &Config::gov_temp_high,       nullptr, 0, 200},
+	{"gov_temp_low",        &Config::gov_temp_low,        nullptr, 0, 200},
+	{"gov_late_high",       &Config::gov_late_high,       nullptr, 0, 100},
+	{"gov_late_low",        &Config::gov_late_low,        nullptr, 0, 100},
+	{"gov_hold",            &Config::gov_hold,            nullptr, 0, 3600},
+	{"fallback",            nullptr, &Config::fallback,        0, 1},
+	{"fallback_window",     &Config::fallback_window,     nullptr, 0.1, 3600},
+	{"fallback_miss_high",  &Config::fallback_miss_high,  nullptr, 0, 100},
+	{"fallback_miss_low",   &Config::fallback_miss_low,   nullptr, 0, 100},
+	{"fallback_probe_interval", &Config::fallback_probe_interval, nullptr, 1, 86400},
+	{"fallback_probe_time", &Config::fallback_probe_time, nullptr, 0.1, 3600},
+	{"stats_interval",      &Config::stats_interval,      nullptr, 0, 86400},
+	{"cpu_budget",          &Config::cpu_budget,          nullptr, 0, 100},
+	{"fan",                 nullptr, &Config::fan,             0, 2},
+	{"fan_curve",           nullptr, nullptr, 0, 0, &Config::fan_curve},
+	{"fan_target",          &Config::fan_target,          nullptr, 0, 200},
+	{"fan_kp",              &Config::fan_kp,              nullptr, 0, 1000},
+	{"fan_ki",              &Config::fan_ki,              nullptr, 0, 1000},
+	{"fan_hysteresis",      &Config::fan_hysteresis,      nullptr, 0, 50},
+	{"fan_min_duty",        &Config::fan_min_duty,        nullptr, 0, 100},
+	{"fan_kick",            &Config::fan_kick,            nullptr, 0, 60},
+	{"fan_pwm",             nullptr, nullptr, 0, 0, &Config::fan_pwm},
+	{"fan_pwm_frequency",   &Config::fan_pwm_frequency,   nullptr, 1, 1e6},
+};
+
+//------------------------------------------------------------------------------
+
+static std::string trim(const std::string &s) {
+	size_t b = s.find_first_not_of(" \t\r");
+	if (b == std::string::npos) return "";
+	size_t e = s.find_last_not_of(" \t\r");
+	return s.substr(b, e - b + 1);
+}
+
+//------------------------------------------------------------------------------
+
+std::vector<std::string> splitList(const std::string &s) {
+	std::vector<std::string> out;
+	size_t b = 0;
+	while ((b = s.find_first_not_of(" \t,", b)) != std::string::npos) {
+		size_t e = s.find_first_of(" \t,", b);
+		if (e == std::string::npos) e = s.size();
+		out.push_back(s.substr(b, e - b));
+		b = e;
+	}
+	return out;
+}
+
+//------------------------------------------------------------------------------
+
+bool parseCurve(const std::string &s, std::vector<std::pair<float, float>> &points) {
+	std::vector<std::pair<float, float>> out;
+	for (auto &p : splitList(s)) {
+		float x, y;
+		char tail;
+		if (sscanf(p.c_str(), "%f:%f%c", &x, &y, &tail) != 2) return false;
+		if (!(y >= 0 && y <= 100)) return false;
+		if (!out.empty() && !(x > out.back().first)) return false;
+		out.push_back({x, y});
+	}
+	if (out.empty()) return false;
+	points.swap(out);
+	return true;
+}
+
+//------------------------------------------------------------------------------
+
+int sourceByName(const std::string &name) {
+	for (int i = 0; i < SOURCES; i++) {
+		if (name == source_names[i]) return i;
+	}
+	return -1;
+}
+
+//------------------------------------------------------------------------------
+
+bool validateConfig(const Config &cfg, std::string &err) {
+	for (auto &k : config_keys) {
+		if (k.s) continue;
+		double v = k.f ? cfg.*(k.f) : cfg.*(k.i);
+		if (!(v >= k.min && v <= k.max)) {
+			std::ostringstream ss;
+			ss << k.name << " out of range [" << k.min << ", " << k.max << "]";
+			err = ss.str();
+			return false;
+		}
+	}
+
+	// Governor needs a gap between its thresholds, or it would oscillate
+	if (cfg.gov_cpu_low >= cfg.gov_cpu_high ||
+	    cfg.gov_temp_low >= cfg.gov_temp_high ||
+	    cfg.gov_late_low >= cfg.gov_late_high) {
+		err = "governor *_low thresholds must be below *_high ones";
+		return false;
+	}
+	if (cfg.sample_dead_band >= cfg.sample_jump) {
+		err = "sample_dead_band must be below sample_jump";
+		return false;
+	}
+	if (cfg.fallback_miss_low > cfg.fallback_miss_high) {
+		err = "fallback_miss_low must not exceed fallback_miss_high";
+		return false;
+	}
+
+	// Bars must show known sources, and only the bars there are
+	for (auto b : {&Config::bar_cpu, &Config::bar_ram, &Config::bar_temp}) {
+		if (sourceByName(cfg.*b) == -1) {
+			err = "unknown source " + cfg.*b;
+			return false;
+		}
+	}
+	std::vector<std::string> ext = splitList(cfg.bar_ext);
+	for (auto &name : ext) {
+		if (sourceByName(name) == -1) {
+			err = "unknown source " + name;
+			return false;
+		}
+	}
+	if (static_cast<int>(ext.size()) > EXT_BARS) {
+		err = "bar_ext lists more bars than the LED driver chain has (" +
+		      std::to_string(EXT_BARS) + ")";
+		return false;
+	}
+
+	std::vector<std::pair<float, float>> curve;
+	if (!parseCurve(cfg.fan_curve, curve)) {
+		err = "fan_curve must list temperature:duty points, "
+		      "temperatures increasing and duties within 0-100";
+		return false;
+	}
+
+	// A full PWM cycle must still make a visible refresh rate,
+	// otherwise LEDs just blink.
+	double cycle = cfg.pwm_lsb_period * (std::pow(2, cfg.pwm_res) - 1);
+	if (cycle > 1000000) {
+		err = "PWM cycle (pwm_lsb_period * (2^pwm_res - 1)) exceeds 1s";
+		return false;
+	}
+	return true;
+}
+
+//------------------------------------------------------------------------------
+
+bool loadConfig(const std::string &path, const Config &base, Config &cfg,
+		std::string &err) {
+	std::ifstream file(path);
+	if (!file.is_open()) {
+		err = "unable to open " + path;
+		return false;
+	}
+
+	// Work on a copy, so a broken file never leaves a half-applied config.
+	// It starts from base rather than cfg, or keys removed from the file
+	// would keep their last values.
+	Config c = base;
+	std::string line;
+	int line_no = 0;
+
+	while (getline(file, line)) {
+		line_no++;
+		size_t hash = line.find('#');
+		if (hash != std::string::npos) line.erase(hash);
+		line = trim(line);
+		if (line.empty()) continue;
+
+		std::string where = path + ":" + std::to_string(line_no) + ": ";
+		size_t eq = line.find('=');
+		if (eq == std::string::npos) {
+			err = where + "expected key = value";
+			return false;
+		}
+		std::string key = trim(line.substr(0, eq));
+		std::string value = trim(line.substr(eq + 1));
+
+		const ConfigKey *k = nullptr;
+		for (auto &ck : config_keys) {
+			if (key == ck.name) k = &ck;
+		}
+		if (!k) {
+			err = where + "unknown key " + key;
+			return false;
+		}
+
+		if (k->s) {
+			c.*(k->s) = value;
+			continue;
+		}
+
+		size_t used = 0;
+		try {
+			if (k->f) c.*(k->f) = std::stof(value, &used);
+			else      c.*(k->i) = std::stoi(value, &used);
+		} catch (...) {
+			used = 0;
+		}
+		if (used == 0 || used != value.size()) {
+			err = where + "invalid value for " + key;
+			return false;
+		}
+	}
+
+	if (!validateConfig(c, err)) {
+		err = path + ": " + err;
+		return false;
+	}
+	cfg = c;
+	return true;
+}
@@ -0,0 +1,225 @@
+// -------------------------------------------------------------------------
+// Runtime configuration
+//
+// config.h: tunables of pistackmond, loaded from a config file
+//
+// Website: https://github.com/tomek-szczesny/pistackmon
+// Authors: Tomek Szczesny, Bernhard Bablok
+// License: GPL3
+// -------------------------------------------------------------------------
+
+#ifndef _CONFIG_H
+#define _CONFIG_H
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#define CONFIG_PATH "/etc/pistackmond.conf"
+
+// Outputs 16 and on (further drivers of a daisy chain) make 5 LED bars,
+// leftover outputs stay unused
+#define EXT_BARS ((CHAIN_WIDTH - 16) / 5)
+
+// Data sources that may be shown on bars
+enum Source {
+	SRC_NONE,
+	SRC_CPU,		// [%]
+	SRC_RAM,		// [%]
+	SRC_TEMP,		// [C]
+	SRC_DISK,		// read + written [bytes/s]
+	SRC_DISK_IOPS,		// reads + writes [1/s]
+	SRC_NET,		// received + transmitted [bytes/s]
+	SRC_NET_RX,		// [bytes/s]
+	SRC_NET_TX,		// [bytes/s]
+	SRC_IPC,		// instructions per cycle
+	SRC_MPKI,		// cache misses per 1000 instructions
+	SRC_FAULTS,		// page faults [1/s]
+	SRC_CPU_NOIO,		// CPU load less iowait [%]
+	SRC_IOWAIT,		// [% of CPU time]
+	SRC_IRQ,		// irq + softirq [% of CPU time]
+	SRC_STEAL,		// [% of CPU time]
+	SRC_CPU_SPLIT,		// CPU load, the iowait part dimmed
+	SOURCES
+};
+
+struct Config {
+	// Data refreshing rate [Hz]
+	float refresh_rate = 10;
+
+	// Refresh divider - the actual data sampling is performed only once
+	// in ref_div, although data smoothing is performed on every refresh cycle.
+	int ref_div = 5;
+
+	// LSB period of a PWM driver [us]
+	// Generally should be kept under 20ms/(2^pwm_res) for PWM operation
+	// above 50Hz for the LED intensity to appear smooth.
+	// Smaller values are possible at the expense of CPU load and accuracy.
+	// Values under 10us are not recommended due to thread sleep accuracy.
+	float pwm_lsb_period = 50;
+
+	// bit depth of PWM LED driver (2-16)
+	int pwm_res = 8;
+
+	// Led intensities adjusted by color
+	// Depending on LED make and model, some colors might appear brighter
+	// than others. These values may be used to equalize these differences.
+	// Defaults are set from the makefile.
+	float led_g = LED_G;
+	float led_y = LED_Y;
+	float led_r = LED_R;
+	float led_b = LED_B;
+	// LEDs on further drivers of a daisy chain (see CHAIN in the makefile)
+	float led_ext = 1.0;
+
+	// "Gamma" correction for LEDs, see led_linear()
+	float led_gamma = LED_GAMMA;
+
+	// Overall brightness factor (0-1)
+	// Applied by blanking all LEDs for a part of each PWM slot,
+	// so it costs no PWM resolution.
+	float brightness = 1;
+
+	// Frequency-aware CPU bar (0 - off, 1 - on)
+	// Idle time is scaled by the mean CPU frequency relative to the maximum
+	// one, so capacity lost to frequency scaling or throttling shows up
+	// as used: 50% busy at 40% of the maximum clock is shown as 80%.
+	int cpu_freq_scale = 0;
+
+	// Brightness of the iowait part of a cpu_split bar, relative to
+	// the rest of it (0-1)
+	float cpu_split_dim = 0.25;
+
+	// Data shown on each bar, one of: none, cpu, ram, temp, disk,
+	// disk_iops, net, net_rx, net_tx, ipc, mpki, faults, cpu_noio, iowait,
+	// irq, steal, cpu_split.
+	// bar_ext lists sources of 5 LED bars on further drivers of a daisy
+	// chain (outputs 16-20, 21-25 and so on).
+	std::string bar_cpu = "cpu";
+	std::string bar_ram = "ram";
+	std::string bar_temp = "temp";
+	std::string bar_ext = "";
+
+	// Block devices and network interfaces summed up by disk* and net*
+	// sources, space or comma separated (e.g. "mmcblk0 sda")
+	std::string disk_devices = "";
+	std::string net_interfaces = "";
+
+	// Rates shown as full bars
+	float disk_full_scale = 100e6;		// [bytes/s]
+	float disk_iops_full_scale = 1000;	// [1/s]
+	float net_full_scale = 125e6;		// [bytes/s]
+
+	// Performance counters (0 - off), for ipc, mpki and faults sources.
+	// Counting costs next to nothing, but needs CAP_PERFMON or
+	// perf_event_paranoid <= 0.
+	int perf_counters = 0;
+	float ipc_full_scale = 2;
+	float mpki_full_scale = 20;
+	float faults_full_scale = 10000;	// [1/s]
+
+	// Adaptive sampling (0 - off). While consecutive samples of every
+	// source stay within sample_dead_band % of its full scale, sampling
+	// slows down, to sample_min_rate at the least. A change of sample_jump %
+	// or more, a user LED write, or a pressure stall trigger (sample_psi,
+	// set on /proc/pressure/{cpu,io,memory}, empty - none) brings it back
+	// to full rate (refresh_rate / ref_div) at once.
+	int adaptive_sampling = 1;
+	float sample_min_rate = 0.2;		// [Hz]
+	float sample_dead_band = 2;		// [%]
+	float sample_jump = 10;			// [%]
+	std::string sample_psi = "some 150000 2000000";
+
+	// Read all files of a sample in one io_uring submission
+	// (see sampler.h), instead of one pread() each
+	int io_uring = 0;
+
+	// Governor, stepping down PWM bit depth, PWM cycle rate and sampling
+	// rate while the host is busy or hot (see governor.h).
+	// Level 0 is the configuration above, each level goes one step further.
+	int governor = 1;			// 0 - disabled
+	int gov_max_level = 3;
+	int gov_min_pwm_res = 5;
+	float gov_min_cycle_rate = 50;		// [Hz]
+	float gov_min_sample_rate = 0.25;	// [Hz]
+
+	// Conditions for stepping down (any of *_high) and back up (all of
+	// *_low), each must hold for gov_hold seconds.
+	// Late slots are PWM slots started later than one LSB period.
+	float gov_cpu_high = 90;		// [%]
+	float gov_cpu_low = 70;			// [%]
+	float gov_temp_high = 75;		// [C]
+	float gov_temp_low = 65;		// [C]
+	float gov_late_high = 5;		// [% of PWM slots]
+	float gov_late_low = 1;			// [% of PWM slots]
+	float gov_hold = 10;			// [s]
+
+	// Fallback to static LEDs (0 - disabled), when more than
+	// fallback_miss_high % of PWM slots start late over fallback_window
+	// seconds. Every fallback_probe_interval seconds PWM is tried again
+	// for fallback_probe_time seconds, and kept if no more than
+	// fallback_miss_low % of slots are late (see supervisor.h).
+	int fallback = 1;
+	float fallback_window = 2;		// [s]
+	float fallback_miss_high = 20;		// [% of PWM slots]
+	float fallback_miss_low = 5;		// [% of PWM slots]
+	float fallback_probe_interval = 60;	// [s]
+	float fallback_probe_time = 2;		// [s]
+
+	// Self-overhead summary is logged every stats_interval seconds
+	// (0 - never). A warning is logged as well if the daemon used more
+	// than cpu_budget % of one CPU over that interval (0 - no budget).
+	float stats_interval = 600;		// [s]
+	float cpu_budget = 0;			// [%]
+
+	// Fan on the Classic fan header (see fan.h)
+	// 0 - off, 1 - duty follows fan_curve, 2 - PI control to fan_target
+	int fan = 0;
+
+	// "temperature:duty" points [C:%], duty is interpolated in between.
+	// The fan stops below the first point.
+	std::string fan_curve = "55:0 60:30 70:60 80:100";
+
+	// Temperature held by PI control [C], proportional gain [%/C]
+	// and integral gain [%/(C*s)]
+	float fan_target = 65;
+	float fan_kp = 8;
+	float fan_ki = 0.4;
+
+	// How far temperature has to drop before the curve lowers the duty,
+	// or before PI control lets the fan stop [C]
+	float fan_hysteresis = 3;
+
+	// Lowest duty a running fan is given [%]. A stopped fan is started
+	// at full duty for fan_kick seconds, many would not spin up at less.
+	float fan_min_duty = 30;
+	float fan_kick = 1;			// [s]
+
+	// Hardware PWM channel driving the fan instead of software PWM of
+	// the fan header pin, e.g. "pwmchip0/pwm0" under /sys/class/pwm
+	std::string fan_pwm = "";
+	float fan_pwm_frequency = 100;		// [Hz]
+};
+
+// Reads "key = value" lines from a file on top of base (defaults, with
+// command line options applied), then validates the result into cfg.
+// Keys left out of the file take their base values, so a reloaded file
+// describes the whole configuration.
+// On failure cfg is left untouched and err describes the problem.
+bool loadConfig(const std::string &path, const Config &base, Config &cfg,
+		std::string &err);
+
+// Checks ranges and cross-dependencies of all the values.
+bool validateConfig(const Config &cfg, std::string &err);
+
+// Splits a space or comma separated list
+std::vector<std::string> splitList(const std::string &s);
+
+// Parses "x:y" points of a curve, x increasing and y within 0-100.
+// Returns false if there are none, or any is malformed.
+bool parseCurve(const std::string &s, std::vector<std::pair<float, float>> &points);
+
+// Returns the source of a given name, or -1 if there is none
+int sourceByName(const std::string &name);
+
+#endif
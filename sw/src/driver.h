@@ -0,0 +1,121 @@
+// -------------------------------------------------------------------------
+// LED driver chip protocol
+//
+// driver.h: shifting, latching and blanking of LED driver outputs
+//
+// Website: https://github.com/tomek-szczesny/pistackmon
+// Authors: Tomek Szczesny, Bernhard Bablok
+// License: GPL3
+// -------------------------------------------------------------------------
+
+#ifndef _DRIVER_H
+#define _DRIVER_H
+
+#include <cstdint>
+
+#ifndef GPIO_HEADER
+#define GPIO_HEADER "gpio.h"	// makefile-generated link to gpio_${PLATFORM}.h
+#endif
+#include GPIO_HEADER
+
+template <int W>
+inline void sendFrame(uint64_t f) {
+	// Sends W bits to LED driver chain but does not latch them.
+	// The most significant bit goes first, so it ends up in the driver
+	// farthest from the Pi. W is a constant, so the whole chain is
+	// shifted in one unrolled pass.
+#ifdef GPIO_BATCHED
+	// DATA is set along with CLK falling edge, then CLK rises.
+	// Two writes per bit is the minimum, as each needs a rising edge.
+	const uint64_t data = 1ull << PIN_DATA;
+	const uint64_t clk = 1ull << PIN_CLK;
+#pragma GCC unroll 64
+	for(int i = W - 1; i >= 0; i--) {
+		gpioWrite(data | clk, ((f >> i) & 1) ? data : 0);
+		gpioWrite(clk, clk);
+	}
+#else
+#pragma GCC unroll 64
+	for(int i = W - 1; i >= 0; i--) {
+		__sync_synchronize();
+		gpioClear(PIN_CLK);
+		if ((f >> i) & 1) {
+                	gpioSet(PIN_DATA);
+		} else {
+                	gpioClear(PIN_DATA);
+		}
+		__sync_synchronize();
+		gpioSet(PIN_CLK);
+	}
+#endif
+}
+
+//  -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   
+
+inline void commitFrame() {
+	// Applies latch pulse to LED driver chain
+	// Thus applying whatever has been previously sent to it
+	// Keeping these separated helps synchronise PWM more precisely
+
+	__sync_synchronize();
+	gpioSet(PIN_LATCH);
+	__sync_synchronize();
+	gpioClear(PIN_LATCH);
+	__sync_synchronize();
+}
+
+//  -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   
+
+inline void gpioInit() {
+	gpioInitImpl();     // platform-specific implementation
+	sendFrame<CHAIN_WIDTH>(0);	// clear all LEDs
+	commitFrame();
+}
+
+//  -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   
+
+inline void setLedState(bool state = true) {
+	__sync_synchronize();
+	if (state) {
+		gpioClear(PIN_BLANK);
+        } else {
+		gpioSet(PIN_BLANK);
+        }
+	__sync_synchronize();
+}
+
+//  -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -
+
+// Fan on the Classic fan header, switched by the PWM thread along with
+// LED bitplanes. Platforms without a fan pin (no GPIO_FAN) have none.
+#ifdef GPIO_FAN
+inline bool fanInit() { return gpioFanInitImpl(); }
+
+inline void setFan(bool on) {
+	__sync_synchronize();
+	gpioFan(on);
+	__sync_synchronize();
+}
+
+inline void fanDeinit() {
+	gpioFan(false);
+	gpioFanDeinitImpl();
+}
+#else
+inline bool fanInit() { return false; }
+inline void setFan(bool) {}
+inline void fanDeinit() {}
+#endif
+
+//  -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -
+
+inline void gpioDeinit(bool noclear = false) {
+
+	if (!noclear) {
+		sendFrame<CHAIN_WIDTH>(0);	// Turn all them LEDs off
+		commitFrame();
+	}
+	gpioDeinitImpl();
+}
+
+#endif
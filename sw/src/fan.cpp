@@ -0,0 +1,183 @@
+// -------------------------------------------------------------------------
+// Fan control
+//
+// fan.cpp: closed-loop control of a fan on the Classic fan header
+//
+// Website: https://github.com/tomek-szczesny/pistackmon
+// Authors: Tomek Szczesny, Bernhard Bablok
+// License: GPL3
+// -------------------------------------------------------------------------
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+
+#include <fcntl.h>		// open()
+#include <unistd.h>		// pwrite(), access()
+
+#include "fan.h"
+
+//================================= CONTROLLER =================================
+
+float FanController::curveDuty(float t) const {
+	// Linear between points, the first and the last duty beyond them,
+	// except below the first point, where the fan is off
+
+	if (curve.empty() || t < curve.front().first) return 0;
+	for (size_t i = 1; i < curve.size(); i++) {
+		const auto &a = curve[i - 1];
+		const auto &b = curve[i];
+		if (t < b.first) {
+			return a.second + (b.second - a.second) *
+			       (t - a.first) / (b.first - a.first);
+		}
+	}
+	return curve.back().second;
+}
+
+//  -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -
+
+float FanController::update(const Config &c, float temp,
+			    std::chrono::steady_clock::time_point now) {
+
+	float dt = has_last ? std::chrono::duration<float>(now - last).count() : 0;
+	last = now;
+	has_last = true;
+
+	// Switching modes starts over
+	if (c.fan != mode) {
+		mode = c.fan;
+		integral = 0;
+		held = temp;
+	}
+	if (!c.fan) {
+		on = false;
+		out = 0;
+		return out;
+	}
+	if (c.fan_curve != curve_src) {
+		parseCurve(c.fan_curve, curve);
+		curve_src = c.fan_curve;
+	}
+
+	float demand;		// [%]
+	bool want;
+	if (temp < 0) {
+		demand = 100;
+		want = true;
+	} else if (c.fan == 1) {
+		// Duty follows rising temperature right away, falling one
+		// only once it is fan_hysteresis below
+		if (temp > held) held = temp;
+		else if (temp < held - c.fan_hysteresis) held = temp + c.fan_hysteresis;
+		demand = curveDuty(held);
+		want = demand > 0;
+	} else {
+		float e = temp - c.fan_target;
+		float p = c.fan_kp * e;
+		float i = integral + c.fan_ki * e * dt;
+		// Integrating further into saturation only winds up
+		bool saturated = (p + i > 100 && e > 0) || (p + i < 0 && e < 0);
+		if (!saturated) integral = std::min(std::max(i, 0.0f), 100.0f);
+		demand = std::min(std::max(p + integral, 0.0f), 100.0f);
+		if (on) {
+			want = demand > 0 || temp > c.fan_target - c.fan_hysteresis;
+		} else {
+			want = demand >= c.fan_min_duty && demand > 0;
+		}
+	}
+
+	if (want && !on) {
+		kick_until = now + std::chrono::duration_cast<
+			std::chrono::steady_clock::duration>(
+			std::chrono::duration<float>(c.fan_kick));
+		started++;
+	}
+	on = want;
+	if (!on) out = 0;
+	else if (now < kick_until) out = 100;
+	else out = std::min(std::max(demand, c.fan_min_duty), 100.0f);
+	return out;
+}
+
+//================================ PWM CHANNEL =================================
+
+static bool writeAttr(const std::string &path, const std::string &value) {
+	int fd = ::open(path.c_str(), O_WRONLY | O_CLOEXEC);
+	if (fd == -1) return false;
+	bool ok = write(fd, value.c_str(), value.size()) ==
+		  static_cast<ssize_t>(value.size());
+	::close(fd);
+	return ok;
+}
+
+//  -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -
+
+bool PwmChannel::open(const std::string &path, float freq, std::string &err) {
+	close();
+
+	size_t slash = path.find_last_of('/');
+	std::string name = path.substr(slash == std::string::npos ? 0 : slash + 1);
+	if (slash == std::string::npos || name.compare(0, 3, "pwm") != 0 ||
+	    name.size() == 3 ||
+	    name.find_first_not_of("0123456789", 3) != std::string::npos) {
+		err = path + " is not a PWM channel (pwmchipN/pwmM)";
+		return false;
+	}
+	chip = path.substr(0, slash);
+	dir = path;
+	channel = std::stoi(name.substr(3));
+
+	if (access(dir.c_str(), F_OK) != 0) {
+		if (!writeAttr(chip + "/export", std::to_string(channel))) {
+			err = chip + "/export: " + std::strerror(errno);
+			return false;
+		}
+		exported = true;
+	}
+
+	// Duty must never exceed the period, so it goes to 0 first
+	period = static_cast<uint64_t>(std::llround(1e9 / freq));
+	if (!writeAttr(dir + "/duty_cycle", "0") ||
+	    !writeAttr(dir + "/period", std::to_string(period)) ||
+	    !writeAttr(dir + "/enable", "1")) {
+		err = dir + ": " + std::strerror(errno);
+		close();
+		return false;
+	}
+	duty_fd = ::open((dir + "/duty_cycle").c_str(), O_WRONLY | O_CLOEXEC);
+	if (duty_fd == -1) {
+		err = dir + "/duty_cycle: " + std::strerror(errno);
+		close();
+		return false;
+	}
+	written = 0;
+	return true;
+}
+
+//  -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -
+
+void PwmChannel::set(float duty) {
+	if (duty_fd == -1) return;
+	int64_t ns = std::llround(period * std::min(std::max(duty, 0.0f), 100.0f) / 100);
+	if (ns == written) return;
+	std::string s = std::to_string(ns);
+	if (pwrite(duty_fd, s.c_str(), s.size(), 0) == static_cast<ssize_t>(s.size()))
+		written = ns;
+}
+
+//  -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -
+
+void PwmChannel::close() {
+	if (duty_fd != -1) {
+		set(0);
+		::close(duty_fd);
+		duty_fd = -1;
+	}
+	if (!dir.empty()) writeAttr(dir + "/enable", "0");
+	if (exported) writeAttr(chip + "/unexport", std::to_string(channel));
+	exported = false;
+	dir.clear();
+	written = -1;
+}
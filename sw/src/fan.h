@@ -0,0 +1,99 @@
+// -------------------------------------------------------------------------
+// Fan control
+//
+// fan.h: closed-loop control of a fan on the Classic fan header
+//
+// Website: https://github.com/tomek-szczesny/pistackmon
+// Authors: Tomek Szczesny, Bernhard Bablok
+// License: GPL3
+// -------------------------------------------------------------------------
+
+#ifndef _FAN_H
+#define _FAN_H
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "config.h"
+
+class FanController {
+	// Works out fan duty from SoC temperature, the same reading the
+	// temperature bar shows, in one of two modes:
+	// - curve: duty is interpolated from fan_curve. Temperature has to
+	//   drop fan_hysteresis below the one that has set the duty before
+	//   the duty goes down, so the fan does not hunt around a point.
+	// - PI: proportional-integral control holding fan_target. The integral
+	//   stops while the output is saturated, so it does not wind up.
+	//   A running fan stops once temperature is fan_hysteresis below
+	//   the target, and starts again only when the output makes up
+	//   fan_min_duty.
+	// A running fan is given fan_min_duty or more, and a stopped one is
+	// kicked at full duty for fan_kick seconds to spin up.
+	// Without a temperature reading the fan runs at full duty.
+
+	private:
+	std::string curve_src;
+	std::vector<std::pair<float, float>> curve;
+	int mode = 0;
+	float held = 0;			// temperature the curve duty is set by
+	float integral = 0;		// [%]
+	float out = 0;			// [%]
+	bool on = false;
+	uint64_t started = 0;
+	bool has_last = false;
+	std::chrono::steady_clock::time_point last;
+	std::chrono::steady_clock::time_point kick_until;
+
+	float curveDuty(float t) const;
+
+	public:
+
+	// Feeds the controller with a temperature reading [C], -1 if there
+	// is none. Returns the fan duty [%].
+	float update(const Config &c, float temp,
+		     std::chrono::steady_clock::time_point now);
+
+	// Duty as of the last update [%]
+	float duty() const { return out; }
+
+	bool running() const { return on; }
+
+	// Spin-ups so far
+	uint64_t starts() const { return started; }
+};
+
+class PwmChannel {
+	// A hardware PWM channel of the sysfs PWM class, exported on open
+	// if it is not yet, and unexported on close then.
+	// Duty is written only when it changes.
+
+	private:
+	std::string chip;		// directory of the chip
+	std::string dir;		// directory of the channel
+	int channel = -1;
+	bool exported = false;
+	int duty_fd = -1;
+	uint64_t period = 0;		// [ns]
+	int64_t written = -1;		// duty cycle [ns]
+
+	public:
+	~PwmChannel() { close(); }
+
+	// path - channel directory, e.g. /sys/class/pwm/pwmchip0/pwm0
+	// freq - PWM frequency [Hz]
+	// Returns false on failure, err says why.
+	bool open(const std::string &path, float freq, std::string &err);
+
+	// duty [%]
+	void set(float duty);
+
+	bool isOpen() const { return duty_fd != -1; }
+
+	// Stops the fan and releases the channel
+	void close();
+};
+
+#endif
@@ -0,0 +1,75 @@
+// -------------------------------------------------------------------------
+// Governor
+//
+// governor.cpp: adapts pistackmond's own CPU budget to host load and heat
+//
+// Website: https://github.com/tomek-szczesny/pistackmon
+// Authors: Tomek Szczesny, Bernhard Bablok
+// License: GPL3
+// -------------------------------------------------------------------------
+
+#include <algorithm>
+#include <cmath>
+
+#include "governor.h"
+
+bool Governor::update(const Config &c, float cpu, float temp, float late,
+		      std::chrono::steady_clock::time_point now) {
+
+	if (!c.governor || c.gov_max_level == 0) {
+		bool changed = (lvl != 0);
+		lvl = 0;
+		trend = 0;
+		return changed;
+	}
+	// Config might have been reloaded with a lower limit
+	if (lvl > c.gov_max_level) {
+		lvl = c.gov_max_level;
+		return true;
+	}
+
+	bool high = cpu >= c.gov_cpu_high || temp >= c.gov_temp_high ||
+		    late >= c.gov_late_high;
+	bool low  = cpu <= c.gov_cpu_low && temp <= c.gov_temp_low &&
+		    late <= c.gov_late_low;
+	int want = high ? 1 : (low ? -1 : 0);
+
+	if (want != trend) {
+		trend = want;
+		since = now;
+		return false;
+	}
+	auto hold = std::chrono::duration<float>(c.gov_hold);
+	if (want == 0 || now - since < hold) return false;
+
+	// Every further step needs the condition to hold again
+	since = now;
+	int next = std::min(std::max(lvl + want, 0), c.gov_max_level);
+	if (next == lvl) return false;
+	lvl = next;
+	return true;
+}
+
+//------------------------------------------------------------------------------
+
+Config Governor::apply(const Config &c) const {
+	// Level n drops n bits of PWM resolution (down to gov_min_pwm_res),
+	// divides PWM cycle rate by 2^n (down to gov_min_cycle_rate)
+	// and sampling rate by 2^n (down to gov_min_sample_rate).
+	// None of the limits is applied if the config is already below it.
+
+	Config e = c;
+	if (lvl == 0) return e;
+
+	e.pwm_res = std::max(c.pwm_res - lvl, std::min(c.gov_min_pwm_res, c.pwm_res));
+
+	float rate = 1000000 / (c.pwm_lsb_period * (std::pow(2, c.pwm_res) - 1));
+	rate = std::max(rate / static_cast<float>(1 << lvl),
+			std::min(c.gov_min_cycle_rate, rate));
+	e.pwm_lsb_period = 1000000 / (rate * (std::pow(2, e.pwm_res) - 1));
+
+	int max_div = std::max(c.ref_div,
+			static_cast<int>(c.refresh_rate / c.gov_min_sample_rate));
+	e.ref_div = std::min(c.ref_div << lvl, max_div);
+	return e;
+}
@@ -0,0 +1,49 @@
+// -------------------------------------------------------------------------
+// Governor
+//
+// governor.h: adapts pistackmond's own CPU budget to host load and heat
+//
+// Website: https://github.com/tomek-szczesny/pistackmon
+// Authors: Tomek Szczesny, Bernhard Bablok
+// License: GPL3
+// -------------------------------------------------------------------------
+
+#ifndef _GOVERNOR_H
+#define _GOVERNOR_H
+
+#include <chrono>
+
+#include "config.h"
+
+class Governor {
+	// When the host is saturated or hot, a real time PWM thread preempting
+	// the workload every few dozen microseconds is the last thing it needs.
+	// Governor steps down through operating levels, each one with lower
+	// PWM bit depth, PWM cycle rate and sampling rate, within the limits
+	// set in the config. It steps back up once the host calms down.
+	// Stepping in either direction requires the condition to hold for
+	// gov_hold seconds, and high/low thresholds provide hysteresis.
+
+	private:
+	int lvl = 0;
+	int trend = 0;		// 1 - stepping down, -1 - stepping up
+	std::chrono::steady_clock::time_point since;
+
+	public:
+
+	// Feeds the governor with current readings.
+	// cpu - [%], temp - [C], late - late PWM slots [%]
+	// Returns true if the operating level has changed.
+	bool update(const Config &c, float cpu, float temp, float late,
+		    std::chrono::steady_clock::time_point now);
+
+	// Returns the config adjusted to the current operating level
+	Config apply(const Config &c) const;
+
+	int level() const { return lvl; }
+
+	// Forces an operating level, e.g. one read from a recording
+	void setLevel(int l) { lvl = l; trend = 0; }
+};
+
+#endif
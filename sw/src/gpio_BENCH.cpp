@@ -0,0 +1,26 @@
+// -------------------------------------------------------------------------
+// GPIO-specific functions
+//
+// gpio_BENCH.cpp: implementation file for benchmarking LED driver routines
+//
+// Website: https://github.com/tomek-szczesny/pistackmon
+// Authors: Tomek Szczesny, Bernhard Bablok
+// License: GPL3
+// -------------------------------------------------------------------------
+
+#include <cstdint>      // uint32_t
+
+#include "gpio_BENCH.h"
+
+// In-memory register standing in for GPIO output registers
+static volatile uint32_t benchreg;
+volatile uint32_t *gpiomap = &benchreg;
+
+void gpioInitImpl() {
+	*gpiomap = 0;
+	__sync_synchronize();
+}
+
+void gpioDeinitImpl() {
+	__sync_synchronize();
+}
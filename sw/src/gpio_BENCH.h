@@ -0,0 +1,37 @@
+// -------------------------------------------------------------------------
+// GPIO-specific functions
+//
+// gpio_BENCH.h: header file for benchmarking LED driver routines
+// GPIO "registers" are a block of ordinary memory and nothing else, so
+// benchmarks time the routines alone, comparably from release to release.
+// The LED driver chain is emulated by gpio_SIM.h instead.
+//
+// Website: https://github.com/tomek-szczesny/pistackmon
+// Authors: Tomek Szczesny, Bernhard Bablok
+// License: GPL3
+// -------------------------------------------------------------------------
+
+#ifndef _GPIO_BENCH_H
+#define _GPIO_BENCH_H
+
+#include <cstdint>
+
+#define PIN_DATA  17
+#define PIN_CLK   27
+#define PIN_LATCH 22
+#define PIN_BLANK 25
+
+extern volatile uint32_t *gpiomap;
+
+void gpioInitImpl();
+void gpioDeinitImpl();
+
+inline void gpioSet(uint8_t pin) {
+	*gpiomap |= (1 << pin);			// Set pin high
+}
+
+inline void gpioClear(uint8_t pin) {
+	*gpiomap &= ~(1 << pin);		// Set pin low
+}
+
+#endif
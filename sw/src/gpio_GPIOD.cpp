@@ -0,0 +1,112 @@
+// -------------------------------------------------------------------------
+// GPIO-specific functions
+//
+// gpio_GPIOD.cpp: implementation file for the GPIO character device
+//
+// Website: https://github.com/tomek-szczesny/pistackmon
+// Authors: Tomek Szczesny, Bernhard Bablok
+// License: GPL3
+// -------------------------------------------------------------------------
+
+#include <cstdint>
+#include <cstdio>       // perror()
+#include <cstdlib>      // getenv(), exit()
+#include <cstring>      // memset(), strncpy()
+#include <fcntl.h>      // open
+#include <unistd.h>     // close
+
+#include "gpio_GPIOD.h"
+
+// File descriptor of the line request, all four lines at once
+int gpiod_fd = -1;
+
+// File descriptor of the fan line request
+int gpiod_fan_fd = -1;
+
+void gpioInitImpl() {
+	const char *chip = getenv("PISTACKMON_GPIOCHIP");
+	const char *lines = getenv("PISTACKMON_GPIOLINES");
+	if (!chip) chip = GPIOD_CHIP;
+	if (!lines) lines = GPIOD_LINES;
+
+	gpio_v2_line_request req;
+	memset(&req, 0, sizeof(req));
+	if (sscanf(lines, "%u,%u,%u,%u", &req.offsets[PIN_DATA],
+		   &req.offsets[PIN_CLK], &req.offsets[PIN_LATCH],
+		   &req.offsets[PIN_BLANK]) != 4) {
+		fprintf(stderr, "Invalid GPIO lines: %s. Quitting!\n", lines);
+		exit(-1);
+	}
+	req.num_lines = 4;
+	strncpy(req.consumer, "pistackmond", sizeof(req.consumer) - 1);
+
+	// Outputs, all low except BLANK, so LEDs stay dark until cleared
+	req.config.flags = GPIO_V2_LINE_FLAG_OUTPUT;
+	req.config.num_attrs = 1;
+	req.config.attrs[0].attr.id = GPIO_V2_LINE_ATTR_ID_OUTPUT_VALUES;
+	req.config.attrs[0].attr.values = 1ull << PIN_BLANK;
+	req.config.attrs[0].mask = 0xF;
+
+	int chipfd = open(chip, O_RDWR | O_CLOEXEC);
+	if (chipfd == -1) {
+		perror(chip);
+		exit(-1);
+	}
+	if (ioctl(chipfd, GPIO_V2_GET_LINE_IOCTL, &req) == -1) {
+		perror("GPIO_V2_GET_LINE_IOCTL failed");
+		exit(-1);
+	}
+	close(chipfd);
+	gpiod_fd = req.fd;
+}
+
+void gpioDeinitImpl() {
+	// Set pins as inputs (default state), then release them
+	gpio_v2_line_config config;
+	memset(&config, 0, sizeof(config));
+	config.flags = GPIO_V2_LINE_FLAG_INPUT;
+	ioctl(gpiod_fd, GPIO_V2_LINE_SET_CONFIG_IOCTL, &config);
+	close(gpiod_fd);
+	gpiod_fd = -1;
+}
+
+bool gpioFanInitImpl() {
+	// Unlike LED lines, a missing fan line is not fatal
+	const char *chip = getenv("PISTACKMON_GPIOCHIP");
+	const char *line = getenv("PISTACKMON_FANLINE");
+	if (!chip) chip = GPIOD_CHIP;
+	if (!line) line = GPIOD_FAN_LINE;
+
+	gpio_v2_line_request req;
+	memset(&req, 0, sizeof(req));
+	if (sscanf(line, "%u", &req.offsets[0]) != 1) {
+		fprintf(stderr, "Invalid GPIO fan line: %s\n", line);
+		return false;
+	}
+	req.num_lines = 1;
+	strncpy(req.consumer, "pistackmond-fan", sizeof(req.consumer) - 1);
+	req.config.flags = GPIO_V2_LINE_FLAG_OUTPUT;	// low
+
+	int chipfd = open(chip, O_RDWR | O_CLOEXEC);
+	if (chipfd == -1) {
+		perror(chip);
+		return false;
+	}
+	if (ioctl(chipfd, GPIO_V2_GET_LINE_IOCTL, &req) == -1) {
+		perror("GPIO_V2_GET_LINE_IOCTL failed for the fan line");
+		close(chipfd);
+		return false;
+	}
+	close(chipfd);
+	gpiod_fan_fd = req.fd;
+	return true;
+}
+
+void gpioFanDeinitImpl() {
+	gpio_v2_line_config config;
+	memset(&config, 0, sizeof(config));
+	config.flags = GPIO_V2_LINE_FLAG_INPUT;
+	ioctl(gpiod_fan_fd, GPIO_V2_LINE_SET_CONFIG_IOCTL, &config);
+	close(gpiod_fan_fd);
+	gpiod_fan_fd = -1;
+}
@@ -0,0 +1,70 @@
+// -------------------------------------------------------------------------
+// GPIO-specific functions
+//
+// gpio_GPIOD.h: header file for the GPIO character device (uAPI v2)
+// Works on any board with a GPIO chip driver, without root access to
+// /dev/mem. Lines are requested once, at init, from the chip and line
+// offsets set in the makefile (GPIOD_CHIP, GPIOD_LINES), or in
+// PISTACKMON_GPIOCHIP and PISTACKMON_GPIOLINES environment variables.
+// Lines are listed in DATA,CLK,LATCH,BLANK order, see pin-table.md.
+// The fan line (GPIOD_FAN_LINE, PISTACKMON_FANLINE) is requested
+// separately, only while a fan is driven.
+//
+// Website: https://github.com/tomek-szczesny/pistackmon
+// Authors: Tomek Szczesny, Bernhard Bablok
+// License: GPL3
+// -------------------------------------------------------------------------
+
+#ifndef _GPIO_GPIOD_H
+#define _GPIO_GPIOD_H
+
+#include <cstdint>
+#include <sys/ioctl.h>
+#include <linux/gpio.h>
+
+// Pins are indices of lines within the request
+#define PIN_DATA  0
+#define PIN_CLK   1
+#define PIN_LATCH 2
+#define PIN_BLANK 3
+
+// Several lines may be changed at once with gpioWrite()
+#define GPIO_BATCHED
+
+// Fan transistor on the Classic fan header, see gpioFan()
+#define GPIO_FAN
+
+extern int gpiod_fd;
+extern int gpiod_fan_fd;
+
+void gpioInitImpl();
+void gpioDeinitImpl();
+
+// Requests the fan line, returns false if it cannot be driven
+bool gpioFanInitImpl();
+void gpioFanDeinitImpl();
+
+inline void gpioWrite(uint64_t mask, uint64_t bits) {
+	// Sets lines selected by mask to respective bits, in one syscall
+	gpio_v2_line_values v;
+	v.mask = mask;
+	v.bits = bits;
+	ioctl(gpiod_fd, GPIO_V2_LINE_SET_VALUES_IOCTL, &v);
+}
+
+inline void gpioSet(uint8_t pin) {
+	gpioWrite(1ull << pin, 1ull << pin);	// Set pin high
+}
+
+inline void gpioClear(uint8_t pin) {
+	gpioWrite(1ull << pin, 0);		// Set pin low
+}
+
+inline void gpioFan(bool on) {
+	gpio_v2_line_values v;
+	v.mask = 1;
+	v.bits = on;
+	ioctl(gpiod_fan_fd, GPIO_V2_LINE_SET_VALUES_IOCTL, &v);
+}
+
+#endif
@@ -46,3 +46,17 @@ void gpioDeinitImpl() {
 	*(gpiomap+2) &= ~(7<<(7*3));	// Pin 27
 	__sync_synchronize();
 }
+
+bool gpioFanInitImpl() {
+	// Low first, so the fan does not start while the pin turns output
+	gpioClear(PIN_FAN);
+	*(gpiomap+1) &= ~(7<<(6*3));		// Pin 16
+	*(gpiomap+1) |=  (1<<(6*3));
+	__sync_synchronize();
+	return true;
+}
+
+void gpioFanDeinitImpl() {
+	*(gpiomap+1) &= ~(7<<(6*3));		// Pin 16
+	__sync_synchronize();
+}
@@ -18,6 +18,10 @@
 #define PIN_LATCH 22
 #define PIN_BLANK 25
 
+// Fan transistor on the Classic fan header, see gpioFan()
+#define PIN_FAN   16
+#define GPIO_FAN
+
 #if defined(PI3)
   #define REG_GPIOMAP 0x3F200000
 #elif defined(PI4)
@@ -29,6 +33,11 @@ extern volatile uint32_t *gpiomap;
 void gpioInitImpl();
 void gpioDeinitImpl();
 
+// Fan pin is an output only while a fan is driven, as it might be
+// wired to something else. Init returns false if it cannot be driven.
+bool gpioFanInitImpl();
+void gpioFanDeinitImpl();
+
 inline void gpioSet(uint8_t pin) {
 	*(gpiomap+7) = (1 << pin);		// Set pin high
 }
@@ -37,4 +46,8 @@ inline void gpioClear(uint8_t pin) {
 	*(gpiomap+10) = (1 << pin);		// Set pin low
 }
 
+inline void gpioFan(bool on) {
+	if (on) gpioSet(PIN_FAN); else gpioClear(PIN_FAN);
+}
+
 #endif
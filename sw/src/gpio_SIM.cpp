@@ -0,0 +1,105 @@
+// -------------------------------------------------------------------------
+// GPIO-specific functions
+//
+// gpio_SIM.cpp: implementation file for a simulated board
+//
+// Website: https://github.com/tomek-szczesny/pistackmon
+// Authors: Tomek Szczesny, Bernhard Bablok
+// License: GPL3
+// -------------------------------------------------------------------------
+
+#include <chrono>
+#include <cstdint>      // uint32_t
+#include <cstring>
+#include <mutex>
+
+#include "clock.h"
+#include "gpio_SIM.h"
+
+// In-memory register standing in for GPIO output registers
+static volatile uint32_t simreg;
+volatile uint32_t *gpiomap = &simreg;
+
+// Emulated driver chain. Shifting is done by the GPIO driving thread only,
+// lit time accounting may be requested by others, hence the mutex.
+static SimChain chain;
+static std::mutex chain_mutex;
+static Clock::time_point last_account;
+void (*simLatchHook)(const SimChain &chain) = nullptr;
+
+//  -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -
+
+static void account() {
+	// Adds time since the last call to every lit output, and the fan
+	// Outputs are lit while latched high and BLANK is low.
+
+	auto now = clk->now();
+	double dt = std::chrono::duration<double>(now - last_account).count();
+	last_account = now;
+	chain.elapsed += dt;
+	if (simreg & (1 << PIN_FAN)) chain.fan += dt;
+	if (simreg & (1 << PIN_BLANK)) return;
+	for (uint64_t o = chain.outputs; o; o &= o - 1) {
+		chain.lit[__builtin_ctzll(o)] += dt;
+	}
+}
+
+//  -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -
+
+void simEdge(uint8_t pin, bool level) {
+	if (pin == PIN_CLK && level) {
+		chain.shift = (chain.shift << 1) | ((simreg >> PIN_DATA) & 1);
+		chain.clocks++;
+	} else if (pin == PIN_LATCH && level) {
+		std::lock_guard<std::mutex> lock(chain_mutex);
+		account();
+		// Bits shifted beyond the last driver of the chain are gone
+		chain.outputs = CHAIN_WIDTH < 64 ?
+				chain.shift & ((1ull << CHAIN_WIDTH) - 1) : chain.shift;
+		chain.latches++;
+		if (simLatchHook) simLatchHook(chain);
+	} else if (pin == PIN_BLANK || pin == PIN_FAN) {
+		std::lock_guard<std::mutex> lock(chain_mutex);
+		account();
+	}
+}
+
+//  -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -
+
+SimChain simChain() {
+	std::lock_guard<std::mutex> lock(chain_mutex);
+	account();
+	return chain;
+}
+
+//  -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -
+
+void simReset() {
+	std::lock_guard<std::mutex> lock(chain_mutex);
+	account();
+	chain.clocks = 0;
+	chain.latches = 0;
+	chain.elapsed = 0;
+	std::memset(chain.lit, 0, sizeof(chain.lit));
+	chain.fan = 0;
+}
+
+//  -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -
+
+void gpioInitImpl() {
+	*gpiomap = 0;
+	last_account = clk->now();
+	__sync_synchronize();
+}
+
+void gpioDeinitImpl() {
+	__sync_synchronize();
+}
+
+bool gpioFanInitImpl() {
+	gpioFan(false);
+	return true;
+}
+
+void gpioFanDeinitImpl() {
+}
@@ -0,0 +1,76 @@
+// -------------------------------------------------------------------------
+// GPIO-specific functions
+//
+// gpio_SIM.h: header file for a simulated board
+// GPIO "registers" are a block of ordinary memory, so pistackmond may be
+// built, run and benchmarked on any machine.
+// A chain of LED drivers is emulated as well, to tell how long each output
+// has actually been lit, in time of the daemon clock (see clock.h), and
+// so is the fan pin, to tell the duty it has been driven at.
+//
+// Website: https://github.com/tomek-szczesny/pistackmon
+// Authors: Tomek Szczesny, Bernhard Bablok
+// License: GPL3
+// -------------------------------------------------------------------------
+
+#ifndef _GPIO_SIM_H
+#define _GPIO_SIM_H
+
+#include <cstdint>
+
+#define PIN_DATA  17
+#define PIN_CLK   27
+#define PIN_LATCH 22
+#define PIN_BLANK 25
+
+// Fan transistor on the Classic fan header, see gpioFan()
+#define PIN_FAN   16
+#define GPIO_FAN
+
+extern volatile uint32_t *gpiomap;
+
+void gpioInitImpl();
+void gpioDeinitImpl();
+bool gpioFanInitImpl();
+void gpioFanDeinitImpl();
+
+// State of the emulated driver chain
+struct SimChain {
+	uint64_t shift;		// Shift register, the last bit clocked in is bit 0
+	uint64_t outputs;	// Latched outputs
+	uint64_t clocks;	// CLK rising edges
+	uint64_t latches;	// LATCH rising edges
+	double elapsed;		// Time since simReset() [s]
+	double lit[64];		// Time each output has been lit since simReset() [s]
+	double fan;		// Time the fan pin has been high since simReset() [s]
+};
+
+// Called on every latch, if set, right after outputs have been updated.
+// The chain is locked meanwhile, so simChain() may not be called from it.
+extern void (*simLatchHook)(const SimChain &chain);
+
+// Called on every pin level change, before the register is updated
+void simEdge(uint8_t pin, bool level);
+
+// Returns the chain state, with lit times accounted up to now.
+// May be called from any thread.
+SimChain simChain();
+
+// Restarts counters and lit time accounting
+void simReset();
+
+inline void gpioSet(uint8_t pin) {
+	if (!(*gpiomap & (1 << pin))) simEdge(pin, true);
+	*gpiomap |= (1 << pin);			// Set pin high
+}
+
+inline void gpioClear(uint8_t pin) {
+	if (*gpiomap & (1 << pin)) simEdge(pin, false);
+	*gpiomap &= ~(1 << pin);		// Set pin low
+}
+
+inline void gpioFan(bool on) {
+	if (on) gpioSet(PIN_FAN); else gpioClear(PIN_FAN);
+}
+
+#endif
@@ -0,0 +1,789 @@
+// -------------------------------------------------------------------------
+// Data sources
+//
+// metrics.cpp: measurements of system stats displayed by pistackmond
+//
+// Website: https://github.com/tomek-szczesny/pistackmon
+// Authors: Tomek Szczesny, Bernhard Bablok
+// License: GPL3
+// -------------------------------------------------------------------------
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <dirent.h>	// opendir()
+#include <fcntl.h>	// open()
+#include <unistd.h>	// sysconf(), pread()
+#include <sys/ioctl.h>	// ioctl()
+#include <sys/syscall.h>	// SYS_perf_event_open
+
+#include <linux/perf_event.h>
+
+#include "clock.h"
+#include "metrics.h"
+
+std::string fs_root = "";
+
+//=================================== MISC =====================================
+
+std::vector<long int> getIntsFromLine(std::string s) {
+	// Returns all integers found in a given string
+
+	std::string temp_s;
+	long int temp_i;
+	std::stringstream ss;
+	std::vector<long int> output;
+
+	ss << s;
+
+	// Reading values from ss one by one, and discarding those that
+	// cannot be converted to int.
+	while (!ss.eof()) {
+		ss >> temp_s;
+		if (std::stringstream(temp_s) >> temp_i) {
+			output.push_back(temp_i);
+		}
+	}
+	return output;
+}
+
+//  -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -
+
+static int readFd(int fd, char *buf, size_t size) {
+	// Reads a sysfs attribute from the beginning, into a null-terminated
+	// buffer. Returns its length or -1.
+
+	ssize_t len = pread(fd, buf, size - 1, 0);
+	if (len < 0) return -1;
+	buf[len] = 0;
+	return static_cast<int>(len);
+}
+
+//  -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -
+
+static bool readFile(const std::string &path, char *buf, size_t size) {
+	int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd == -1) return false;
+	int len = readFd(fd, buf, size);
+	::close(fd);
+	return len > 0;
+}
+
+//  -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -
+
+static inline const char *skipSpaces(const char *p) {
+	while (*p == ' ' || *p == '\t') p++;
+	return p;
+}
+
+static inline const char *nextLine(const char *p) {
+	while (*p && *p != '\n') p++;
+	return *p ? p + 1 : p;
+}
+
+static inline uint64_t parseU64(const char *&p) {
+	p = skipSpaces(p);
+	uint64_t v = 0;
+	while (*p >= '0' && *p <= '9') v = v * 10 + (*p++ - '0');
+	return v;
+}
+
+//================================ DATA SOURCES ================================
+
+float fetchTemp() {
+	// Returns CPU temperature in degrees C
+
+	const std::string temp_file_name = fs_root + THERMAL_PATH;
+	char buf[32];
+
+	if (!readFile(temp_file_name, buf, sizeof(buf))) {
+          	std::fprintf(stderr,"Unable to open %s.\n",
+						temp_file_name.c_str());
+		return -1.0;
+	}
+	return tempFromSysfs(buf);
+}
+
+//  -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -
+
+float tempFromSysfs(const char *temp) {
+	// The thermal zone reports millidegrees
+
+	float result = std::strtof(temp, nullptr);
+	result /= 1000;
+	return result;	
+}
+
+//------------------------------------------------------------------------------
+
+float fetchLoadavg() {
+	// Returns an instantaneous CPU load estimate in %:
+	// 1 minute load average per online CPU.
+	// It counts tasks waiting for I/O as well, so it is a rough one.
+
+	std::ifstream load_file(fs_root + "/proc/loadavg");
+	float load = 0;
+	if (!(load_file >> load)) return 0;
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (cpus < 1) cpus = 1;
+	return std::min(100.0f, 100 * load / cpus);
+}
+
+//------------------------------------------------------------------------------
+
+// CPU time counters of /proc/stat [ticks], in the order of its columns
+struct CpuTicks {
+	uint64_t user = 0;
+	uint64_t nice = 0;
+	uint64_t system = 0;
+	uint64_t idle = 0;
+	uint64_t iowait = 0;
+	uint64_t irq = 0;
+	uint64_t softirq = 0;
+	uint64_t steal = 0;
+};
+
+// Counters of the last call, and its results
+static CpuTicks last_ticks;
+static bool has_ticks = false;
+static float last_cpu = 0;
+static CpuTimes last_times;
+
+float fetchCpu() {
+	// Only the first line of /proc/stat is needed, the rest is cut off
+
+	char buf[512];
+	if (!readFile(fs_root + "/proc/stat", buf, sizeof(buf))) {
+          	std::fprintf(stderr,"Unable to open /proc/stat. Quitting!\n");
+		exit(-1);
+	}
+	return cpuFromStat(buf);
+}
+
+//  -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -
+
+float cpuFromStat(const char *stat) {
+	// Returns CPU load in %.
+	// It's a mean value for all cores,
+	// and a mean value since the last call of this method.
+	// 
+	// /proc/stat contains counters of CPU time dedicated to various tasks.
+	// Fourth column is the CPU idle time.
+	// This function computes how much time CPUs were *not* idle,
+	// and keeps the share of every column for cpuTimes().
+	//
+	// Too frequent calling (< 50ms) yields results with poor resolution,
+	// due to kernel counters working typically at 100Hz.
+	// It is recommended to apply some sort of low-pass filter
+	// for more meaningful long-term results.
+
+	// The first line sums up all CPUs: "cpu", then the counters.
+	// Kernels older than 2.6.33 have fewer than 8 of them, the missing
+	// ones stay at zero.
+	const char *p = stat;
+	while (*p && *p != ' ') p++;
+	CpuTicks t;
+	uint64_t *cols[] = {&t.user, &t.nice, &t.system, &t.idle,
+			    &t.iowait, &t.irq, &t.softirq, &t.steal};
+	int n = 0;
+	while (n < 8 && *(p = skipSpaces(p)) >= '0' && *p <= '9') {
+		*cols[n++] = parseU64(p);
+	}
+	if (n < 4) return last_cpu;
+
+	// On first run there is nothing to compare against yet.
+	// Load average stands in until the next call,
+	// so startup does not have to wait for counters to tick.
+	if (!has_ticks) {
+		last_ticks = t;
+		has_ticks = true;
+		last_cpu = fetchLoadavg();
+		last_times = CpuTimes();
+		last_times.user = last_cpu;
+		last_times.idle = 100 - last_cpu;
+		return last_cpu;
+	}
+
+	CpuTicks d;
+	d.user = t.user - last_ticks.user;
+	d.nice = t.nice - last_ticks.nice;
+	d.system = t.system - last_ticks.system;
+	d.idle = t.idle - last_ticks.idle;
+	d.iowait = t.iowait - last_ticks.iowait;
+	d.irq = t.irq - last_ticks.irq;
+	d.softirq = t.softirq - last_ticks.softirq;
+	d.steal = t.steal - last_ticks.steal;
+	uint64_t total = d.user + d.nice + d.system + d.idle +
+			 d.iowait + d.irq + d.softirq + d.steal;
+	
+	// This might happen if called too soon after last call
+	// The result would be division by zero - nan.
+	// Nothing has changed since then, so the last result still holds.
+	if (total == 0) return last_cpu;
+	
+	// The fourth column represents CPU idle time
+	float result = d.idle;
+	result /= total;
+	result = 1 - result;
+	result *= 100;
+
+	const float share = 100.0f / total;
+	last_times.user = d.user * share;
+	last_times.nice = d.nice * share;
+	last_times.system = d.system * share;
+	last_times.idle = d.idle * share;
+	last_times.iowait = d.iowait * share;
+	last_times.irq = d.irq * share;
+	last_times.softirq = d.softirq * share;
+	last_times.steal = d.steal * share;
+
+	last_ticks = t;
+	last_cpu = result;
+	return result;	
+}
+
+//  -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -
+
+const CpuTimes &cpuTimes() {
+	return last_times;
+}
+
+//------------------------------------------------------------------------------
+
+float fetchRam() {
+	char buf[4096];
+	if (!readFile(fs_root + "/proc/meminfo", buf, sizeof(buf))) {
+          	std::fprintf(stderr,"Unable to open /proc/meminfo. Quitting!\n");
+		exit(-1);
+	}
+	return ramFromMeminfo(buf);
+}
+
+//  -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -
+
+static inline bool startsWith(const char *p, const char *prefix, size_t len) {
+	return std::strncmp(p, prefix, len) == 0;
+}
+
+float ramFromMeminfo(const char *meminfo) {
+	// Returns percentage of used RAM.
+	// Used memory estimated just like "free" does:
+	// MemTotal - MemFree - Buffers - Cached - SReclaimable
+	// See "man free" for details.
+	
+	int memtotal = 1;
+	float result = 0;
+
+	for (const char *p = meminfo; *p; p = nextLine(p)) {
+		const char *v = p;
+		while (*v && *v != ':' && *v != '\n') v++;
+		if (*v != ':') continue;
+		size_t len = v++ - p;
+		if 	(startsWith(p, "MemTotal", len))
+			memtotal = parseU64(v);
+		else if	(startsWith(p, "MemFree", len) ||
+			 startsWith(p, "Buffers", len) ||
+			 startsWith(p, "Cached", len) ||
+			 startsWith(p, "SReclaimable", len))
+			result -= parseU64(v);
+	}
+
+	result /= memtotal;
+	result += 1;
+	result *= 100;
+	return result;
+}
+
+//================================ CPU FREQUENCY ===============================
+
+bool CpuFreq::open(const std::string &sysfs_root) {
+	const std::string sysfs = sysfs_root.empty() ? fs_root + "/sys" : sysfs_root;
+	const std::string dir = sysfs + "/devices/system/cpu/cpufreq";
+	char buf[256];
+
+	DIR *d = opendir(dir.c_str());
+	if (d) {
+		while (dirent *e = readdir(d)) {
+			std::string name = e->d_name;
+			if (name.compare(0, 6, "policy") != 0) continue;
+			std::string path = dir + "/" + name + "/";
+
+			Policy p;
+			if (!readFile(path + "cpuinfo_max_freq", buf, sizeof(buf)))
+				continue;
+			p.max_freq = std::strtof(buf, nullptr);
+			if (!(p.max_freq > 0)) continue;
+			if (readFile(path + "affected_cpus", buf, sizeof(buf)))
+				p.cpus = std::max(1,
+					static_cast<int>(getIntsFromLine(buf).size()));
+			p.stats_fd = ::open((path + "stats/time_in_state").c_str(),
+					    O_RDONLY | O_CLOEXEC);
+			if (p.stats_fd == -1)
+				p.cur_fd = ::open((path + "scaling_cur_freq").c_str(),
+						  O_RDONLY | O_CLOEXEC);
+			if (p.stats_fd == -1 && p.cur_fd == -1) continue;
+			policies.push_back(p);
+		}
+		closedir(d);
+	}
+
+	throttled_fd = ::open((sysfs +
+			"/devices/platform/soc/soc:firmware/get_throttled").c_str(),
+			O_RDONLY | O_CLOEXEC);
+
+	// Seeds time_in_state counters
+	capacity();
+	last_capacity = 1;
+	return !policies.empty();
+}
+
+//  -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -
+
+void CpuFreq::addTo(Sampler &s) {
+	for (auto &p : policies) {
+		p.src = s.add(p.stats_fd != -1 ? p.stats_fd : p.cur_fd);
+	}
+	throttled_src = s.add(throttled_fd, 32);
+}
+
+//  -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -
+
+float CpuFreq::capacity(const Sampler *s) {
+	if (policies.empty()) return 1;
+
+	char buf[2048];
+	float sum = 0;
+	int cpus = 0;
+
+	for (auto &p : policies) {
+		float ratio = -1;
+		const char *text = nullptr;
+		if (s) {
+			text = s->data(p.src);
+		} else if (readFd(p.stats_fd != -1 ? p.stats_fd : p.cur_fd,
+				  buf, sizeof(buf)) > 0) {
+			text = buf;
+		}
+		if (!text || !*text) {
+			// Not read, ratio stays unknown
+		} else if (p.stats_fd != -1) {
+			// "frequency time" lines, in the same order every time.
+			// Frequency weighted by time spent at it, since the last call.
+			const char *ptr = text;
+			size_t i = 0;
+			double weighted = 0, total = 0;
+			while (*ptr) {
+				char *end;
+				uint64_t freq = std::strtoull(ptr, &end, 10);
+				if (end == ptr) break;
+				uint64_t t = std::strtoull(end, &end, 10);
+				ptr = end;
+				if (i == p.last.size()) p.last.push_back(t);
+				uint64_t dt = t - p.last[i];
+				p.last[i++] = t;
+				weighted += static_cast<double>(freq) * dt;
+				total += dt;
+			}
+			if (total > 0) ratio = weighted / total / p.max_freq;
+		} else {
+			ratio = std::strtof(text, nullptr) / p.max_freq;
+		}
+		// No time has passed, or the file could not be read
+		if (ratio < 0) continue;
+		sum += std::min(ratio, 1.0f) * p.cpus;
+		cpus += p.cpus;
+	}
+
+	if (cpus) last_capacity = sum / cpus;
+	return last_capacity;
+}
+
+//  -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -
+
+int CpuFreq::throttled(const Sampler *s) {
+	char buf[32];
+	const char *text = buf;
+	if (s) text = s->data(throttled_src);
+	else if (throttled_fd == -1 || readFd(throttled_fd, buf, sizeof(buf)) <= 0)
+		return -1;
+	if (!text || !*text) return -1;
+	return static_cast<int>(std::strtoul(text, nullptr, 16));
+}
+
+//  -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -
+
+void CpuFreq::close() {
+	for (auto &p : policies) {
+		if (p.stats_fd != -1) ::close(p.stats_fd);
+		if (p.cur_fd != -1) ::close(p.cur_fd);
+	}
+	policies.clear();
+	if (throttled_fd != -1) ::close(throttled_fd);
+	throttled_fd = -1;
+	throttled_src = -1;
+}
+
+//================================ I/O THROUGHPUT ==============================
+
+bool ProcFile::open(const std::string &path) {
+	fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd == -1) return false;
+	buf.resize(4096);
+	return read() != nullptr;
+}
+
+//  -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -
+
+const char *ProcFile::read() {
+	// The buffer only grows while the table does, which is rare
+
+	if (fd == -1) return nullptr;
+	size_t len = 0;
+	while (true) {
+		ssize_t r = pread(fd, buf.data() + len, buf.size() - len - 1, len);
+		if (r < 0) return nullptr;
+		if (r == 0) break;
+		len += r;
+		if (len + 1 == buf.size()) buf.resize(buf.size() * 2);
+	}
+	buf[len] = 0;
+	return buf.data();
+}
+
+//  -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -
+
+void ProcFile::close() {
+	if (fd != -1) ::close(fd);
+	fd = -1;
+}
+
+//  -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -
+
+bool IoCounters::open(const std::string &path,
+		      const std::vector<std::string> &devices) {
+	names = devices;
+	last.assign(names.size(), {0, 0});
+	seen.assign(names.size(), false);
+	first = true;
+	if (names.empty()) return false;
+	if (!file.open(path)) {
+		std::fprintf(stderr, "Unable to open %s.\n", path.c_str());
+		return false;
+	}
+
+	// Reports devices not there (yet), they are picked up
+	// if they show up later on
+	sample(clk->now());
+	for (size_t i = 0; i < names.size(); i++) {
+		if (!seen[i]) std::fprintf(stderr, "%s not found in %s.\n",
+					   names[i].c_str(), path.c_str());
+	}
+	return true;
+}
+
+//  -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -
+
+void IoCounters::addTo(Sampler &s) {
+	src = s.add(file.handle());
+}
+
+//  -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -
+
+std::array<float, 2> IoCounters::sample(std::chrono::steady_clock::time_point now,
+					const Sampler *s) {
+	std::array<float, 2> rate = {0, 0};
+	const char *p = s ? s->data(src) : file.read();
+	if (!p) return rate;
+
+	double dt = std::chrono::duration<double>(now - last_t).count();
+	uint64_t delta[2] = {0, 0};
+	std::array<uint64_t, 2> v;
+	size_t dev;
+
+	for (; *p; p = nextLine(p)) {
+		if (!parseLine(p, dev, v)) continue;
+		// Counters going back mean the device has been re-added
+		for (int i = 0; i < 2; i++) {
+			if (seen[dev] && v[i] >= last[dev][i])
+				delta[i] += v[i] - last[dev][i];
+		}
+		last[dev] = v;
+		seen[dev] = true;
+	}
+
+	if (!first && dt > 0) {
+		rate[0] = delta[0] / dt;
+		rate[1] = delta[1] / dt;
+	}
+	first = false;
+	last_t = now;
+	return rate;
+}
+
+//  -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -
+
+void IoCounters::close() {
+	file.close();
+	names.clear();
+	src = -1;
+}
+
+//  -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -
+
+static inline bool matchName(const std::vector<std::string> &names,
+			     const char *name, size_t len, size_t &dev) {
+	// Compares a name in place with the interned ones
+
+	for (size_t i = 0; i < names.size(); i++) {
+		if (names[i].size() == len && !std::memcmp(names[i].data(), name, len)) {
+			dev = i;
+			return true;
+		}
+	}
+	return false;
+}
+
+//  -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -
+
+bool DiskStats::parseLine(const char *&p, size_t &dev,
+			  std::array<uint64_t, 2> &v) {
+	// "major minor name reads merged sectors ms writes merged sectors ..."
+	// Sectors are 512 bytes, whatever the device.
+
+	parseU64(p);
+	parseU64(p);
+	const char *name = skipSpaces(p);
+	p = name;
+	while (*p && *p != ' ' && *p != '\n') p++;
+	if (!matchName(names, name, p - name, dev)) return false;
+
+	uint64_t f[7];
+	for (auto &x : f) x = parseU64(p);
+	v[0] = (f[2] + f[6]) * 512;
+	v[1] = f[0] + f[4];
+	return true;
+}
+
+//  -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -
+
+bool NetDev::parseLine(const char *&p, size_t &dev,
+		       std::array<uint64_t, 2> &v) {
+	// "name: rx_bytes packets errs drop fifo frame compressed multicast
+	//  tx_bytes ...", there may be no space after the colon.
+	// Header lines have no colon.
+
+	const char *name = skipSpaces(p);
+	p = name;
+	while (*p && *p != ':' && *p != '\n') p++;
+	if (*p != ':') return false;
+	if (!matchName(names, name, p - name, dev)) return false;
+	p++;
+
+	v[0] = parseU64(p);
+	for (int i = 0; i < 7; i++) parseU64(p);
+	v[1] = parseU64(p);
+	return true;
+}
+
+//============================ PERFORMANCE COUNTERS ============================
+
+static int perfEvent(uint32_t type, uint64_t config, int cpu, int group) {
+	// Opens a system-wide counter on a CPU, a group leader if group is -1.
+	// Leaders start disabled, and are enabled with their whole group.
+
+	perf_event_attr attr;
+	std::memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = type;
+	attr.config = config;
+	attr.disabled = group == -1;
+	attr.exclude_hv = 1;
+	attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED |
+			   PERF_FORMAT_TOTAL_TIME_RUNNING;
+	return static_cast<int>(syscall(SYS_perf_event_open, &attr, -1, cpu,
+					group, PERF_FLAG_FD_CLOEXEC));
+}
+
+//  -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -
+
+bool PerfCounters::openGroup(Group &g, int cpu, bool hardware) {
+	// Members are opened in the order of COUNTERS, so they are read in
+	// that order. Last level cache read misses are counted where the PMU
+	// has such an event, generic cache misses otherwise.
+	// A software group is page faults alone.
+
+	if (!hardware) {
+		g.fd = perfEvent(PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS, cpu, -1);
+		return g.fd != -1;
+	}
+	g.fd = perfEvent(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, cpu, -1);
+	if (g.fd == -1) return false;
+
+	int fd = perfEvent(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, cpu, g.fd);
+	if (fd != -1) g.members.push_back(fd);
+	if (fd != -1) {
+		fd = perfEvent(PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_LL |
+			       (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+			       (PERF_COUNT_HW_CACHE_RESULT_MISS << 16), cpu, g.fd);
+		if (fd == -1) fd = perfEvent(PERF_TYPE_HARDWARE,
+					     PERF_COUNT_HW_CACHE_MISSES, cpu, g.fd);
+		if (fd != -1) g.members.push_back(fd);
+	}
+	if (fd != -1) {
+		fd = perfEvent(PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS, cpu, g.fd);
+		if (fd != -1) g.members.push_back(fd);
+	}
+	if (fd == -1) {
+		int e = errno;
+		for (int m : g.members) ::close(m);
+		g.members.clear();
+		::close(g.fd);
+		g.fd = -1;
+		errno = e;
+		return false;
+	}
+	return true;
+}
+
+//  -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -
+
+bool PerfCounters::open(std::string &err) {
+	// Hardware groups on every online CPU, or software ones on all of
+	// them, so the sums are of the same events. Offline CPUs (ENODEV)
+	// are left out.
+
+	close();
+	long cpus = sysconf(_SC_NPROCESSORS_CONF);
+	for (int pass = 0; pass < 2 && groups.empty(); pass++) {
+		hw = pass == 0;
+		for (int cpu = 0; cpu < cpus; cpu++) {
+			Group g;
+			if (openGroup(g, cpu, hw)) {
+				groups.push_back(g);
+			} else if (errno != ENODEV) {
+				err = std::string(hw ? "hardware" : "software") +
+				      " events: " + std::strerror(errno);
+				close();
+				break;
+			}
+		}
+	}
+	if (groups.empty()) {
+		hw = false;
+		return false;
+	}
+
+	for (auto &g : groups) {
+		ioctl(g.fd, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+		ioctl(g.fd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+	}
+	first = true;
+	sample(clk->now());
+	return true;
+}
+
+//  -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -
+
+std::array<float, 3> PerfCounters::sample(std::chrono::steady_clock::time_point now) {
+	// A group read is {nr, time enabled, time running, values[nr]}.
+	// Groups share the PMU with other users, so each may have been
+	// counting only part of the time. Its counts are scaled by the time
+	// it was enabled over the time it was running, which leaves ratios
+	// within a group as they are.
+
+	std::array<float, 3> out = {-1, -1, 0};
+	double sum[COUNTERS] = {};
+	uint64_t buf[3 + COUNTERS];
+
+	for (auto &g : groups) {
+		ssize_t len = read(g.fd, buf, sizeof(buf));
+		if (len < static_cast<ssize_t>(3 * sizeof(uint64_t))) continue;
+		size_t n = std::min<size_t>(buf[0], COUNTERS);
+		uint64_t v[COUNTERS] = {};
+		if (hw) {
+			for (size_t i = 0; i < n; i++) v[i] = buf[3 + i];
+		} else {
+			v[FAULTS] = buf[3];
+		}
+		uint64_t enabled = buf[1] - g.last_enabled;
+		uint64_t running = buf[2] - g.last_running;
+		double scale = running ? static_cast<double>(enabled) / running : 0;
+		for (int i = 0; i < COUNTERS; i++) {
+			sum[i] += (v[i] - g.last[i]) * scale;
+			g.last[i] = v[i];
+		}
+		g.last_enabled = buf[1];
+		g.last_running = buf[2];
+	}
+
+	double dt = std::chrono::duration<double>(now - last_t).count();
+	if (!first) {
+		if (hw && sum[CYCLES] > 0) out[0] = sum[INSTRUCTIONS] / sum[CYCLES];
+		if (hw && sum[INSTRUCTIONS] > 0)
+			out[1] = 1000 * sum[MISSES] / sum[INSTRUCTIONS];
+		if (dt > 0) out[2] = sum[FAULTS] / dt;
+	}
+	first = false;
+	last_t = now;
+	return out;
+}
+
+//  -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -
+
+void PerfCounters::close() {
+	for (auto &g : groups) {
+		for (int m : g.members) ::close(m);
+		::close(g.fd);
+	}
+	groups.clear();
+}
+
+//=============================== PRESSURE STALLS ==============================
+
+bool PsiTriggers::open(const std::string &trigger, std::string &err) {
+	// A trigger lives as long as the descriptor it was written to.
+	// The string is written along with its terminating null.
+
+	close();
+	for (const char *res : {"cpu", "io", "memory"}) {
+		std::string path = fs_root + "/proc/pressure/" + res;
+		int fd = ::open(path.c_str(), O_RDWR | O_NONBLOCK | O_CLOEXEC);
+		if (fd != -1 && write(fd, trigger.c_str(), trigger.size() + 1) < 0) {
+			err = path + ": " + std::strerror(errno);
+			::close(fd);
+			continue;
+		}
+		if (fd == -1) {
+			err = path + ": " + std::strerror(errno);
+			continue;
+		}
+		fds.push_back({fd, POLLPRI, 0});
+	}
+	return !fds.empty();
+}
+
+//  -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -
+
+bool PsiTriggers::fired() {
+	if (fds.empty()) return false;
+	if (poll(fds.data(), fds.size(), 0) <= 0) return false;
+	bool any = false;
+	for (auto &p : fds) {
+		if ((p.revents & POLLPRI) && !(p.revents & (POLLERR | POLLNVAL))) any = true;
+	}
+	return any;
+}
+
+//  -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -
+
+void PsiTriggers::close() {
+	for (auto &p : fds) ::close(p.fd);
+	fds.clear();
+}
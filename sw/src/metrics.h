@@ -0,0 +1,255 @@
+// -------------------------------------------------------------------------
+// Data sources
+//
+// metrics.h: measurements of system stats displayed by pistackmond
+//
+// Website: https://github.com/tomek-szczesny/pistackmon
+// Authors: Tomek Szczesny, Bernhard Bablok
+// License: GPL3
+// -------------------------------------------------------------------------
+
+#ifndef _METRICS_H
+#define _METRICS_H
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <poll.h>		// pollfd
+
+#include "sampler.h"
+
+// Prepended to /proc and /sys paths, so measurements may be taken from
+// a copy of these trees (e.g. fixtures of sim.cpp). Empty by default.
+extern std::string fs_root;
+
+#define THERMAL_PATH "/sys/devices/virtual/thermal/thermal_zone0/temp"
+
+// Returns all integers found in a given string
+std::vector<long int> getIntsFromLine(std::string s);
+
+// Returns CPU temperature in degrees C, or -1 if not available
+float fetchTemp();
+
+// Returns an instantaneous CPU load estimate in %, from load average
+float fetchLoadavg();
+
+// Returns CPU load in % since the last call, iowait counting as load.
+// The first call returns fetchLoadavg().
+float fetchCpu();
+
+// CPU time of all CPUs by /proc/stat columns, as shares of the time
+// passed between the last two fetchCpu() or cpuFromStat() calls [%].
+// guest and guest_nice are left out, being part of user and nice already.
+struct CpuTimes {
+	float user = 0;
+	float nice = 0;
+	float system = 0;
+	float idle = 100;
+	float iowait = 0;
+	float irq = 0;
+	float softirq = 0;
+	float steal = 0;
+};
+const CpuTimes &cpuTimes();
+
+// Returns percentage of used RAM
+float fetchRam();
+
+// Same as above, from contents of /proc/stat, /proc/meminfo and the thermal
+// zone read elsewhere (see Sampler). cpuFromStat() and fetchCpu() share
+// the last counters.
+float cpuFromStat(const char *stat);
+float ramFromMeminfo(const char *meminfo);
+float tempFromSysfs(const char *temp);
+
+// Raspberry Pi firmware throttling flags (get_throttled), bits 0-3 being
+// the current state, and 16-19 the same conditions since boot
+#define THROTTLED_UNDERVOLT  0x1
+#define THROTTLED_FREQ_CAP   0x2
+#define THROTTLED_THROTTLED  0x4
+#define THROTTLED_SOFT_TEMP  0x8
+#define THROTTLED_NOW        0xF
+
+class CpuFreq {
+	// CPU capacity lost to frequency scaling, and firmware throttling.
+	// All files are opened once, each sample costs one pread() per
+	// cpufreq policy, plus one for throttling flags.
+
+	private:
+	struct Policy {
+		int stats_fd = -1;		// stats/time_in_state
+		int cur_fd = -1;		// scaling_cur_freq, if no stats
+		int src = -1;			// either one in a Sampler
+		int cpus = 1;
+		float max_freq = 1;		// [kHz]
+		std::vector<uint64_t> last;	// time in each state [10ms]
+	};
+	std::vector<Policy> policies;
+	int throttled_fd = -1;
+	int throttled_src = -1;
+	float last_capacity = 1;
+
+	public:
+
+	// Opens cpufreq files found under sysfs root (fs_root + "/sys" if empty).
+	// Returns false if there are none, capacity() is 1 then.
+	bool open(const std::string &sysfs = "");
+
+	// Adds the files to a sampler, so capacity() and throttled() may
+	// parse what it has read instead of reading them
+	void addTo(Sampler &s);
+
+	// Returns mean CPU frequency since the last call, relative to
+	// the maximum one (0-1), over all policies weighted by their CPUs.
+	// Uses time_in_state where available, current frequency otherwise.
+	// Files are read here, or taken from s if given.
+	float capacity(const Sampler *s = nullptr);
+
+	// Returns firmware throttling flags, -1 if not available
+	int throttled(const Sampler *s = nullptr);
+
+	void close();
+};
+
+//  -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -
+
+class ProcFile {
+	// A file kept open and read whole into a buffer reused between reads,
+	// so tables in /proc may be parsed in place
+
+	private:
+	int fd = -1;
+	std::vector<char> buf;
+
+	public:
+	bool open(const std::string &path);
+
+	int handle() const { return fd; }
+
+	// Returns null-terminated contents, valid until the next call,
+	// or nullptr on failure
+	const char *read();
+
+	void close();
+};
+
+//  -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -
+
+class IoCounters {
+	// Rates of counters of chosen devices in a /proc table, summed up
+	// over the devices. Names are interned once, each sample is one read
+	// and a scan of the table in place.
+
+	protected:
+	ProcFile file;
+	std::vector<std::string> names;
+	std::vector<std::array<uint64_t, 2>> last;	// per device
+	std::vector<bool> seen;
+	std::chrono::steady_clock::time_point last_t;
+	bool first = true;
+	int src = -1;				// the table in a Sampler
+
+	// Finds counters of a device in the table, returns false if it's
+	// not one of ours
+	virtual bool parseLine(const char *&p, size_t &dev,
+			       std::array<uint64_t, 2> &v) = 0;
+
+	public:
+	virtual ~IoCounters() {}
+
+	// Opens the table and interns device names. Returns false if there
+	// are no devices, or the table cannot be read.
+	bool open(const std::string &path, const std::vector<std::string> &devices);
+
+	// Adds the table to a sampler, if open
+	void addTo(Sampler &s);
+
+	// Returns rates of both counters since the last call, or open() [1/s].
+	// The table is read here, or taken from s if given.
+	std::array<float, 2> sample(std::chrono::steady_clock::time_point now,
+				    const Sampler *s = nullptr);
+
+	void close();
+};
+
+// Read + written bytes, and reads + writes completed,
+// of block devices in /proc/diskstats
+class DiskStats : public IoCounters {
+	protected:
+	bool parseLine(const char *&p, size_t &dev,
+		       std::array<uint64_t, 2> &v) override;
+};
+
+// Received and transmitted bytes of network interfaces in /proc/net/dev
+class NetDev : public IoCounters {
+	protected:
+	bool parseLine(const char *&p, size_t &dev,
+		       std::array<uint64_t, 2> &v) override;
+};
+
+// IPC, cache misses and page faults of all CPUs, from perf_event_open
+// counter groups, one per CPU, each read with a single read(). Where there
+// is no hardware PMU (VMs, CI), groups fall back to software events, which
+// count page faults, but no cycles or instructions.
+// Needs CAP_PERFMON, or perf_event_paranoid of 0 or less.
+class PerfCounters {
+	private:
+	// Counters of a group, in the order they are read
+	enum { CYCLES, INSTRUCTIONS, MISSES, FAULTS, COUNTERS };
+	struct Group {
+		int fd = -1;			// leader
+		std::vector<int> members;
+		uint64_t last[COUNTERS] = {};
+		uint64_t last_enabled = 0;	// [ns]
+		uint64_t last_running = 0;	// [ns]
+	};
+	std::vector<Group> groups;
+	bool hw = false;
+	bool first = true;
+	std::chrono::steady_clock::time_point last_t;
+
+	bool openGroup(Group &g, int cpu, bool hardware);
+
+	public:
+	// Opens a group on every online CPU, hardware ones if possible.
+	// Returns false if none could be opened, err says why.
+	bool open(std::string &err);
+
+	bool isOpen() const { return !groups.empty(); }
+
+	// True if groups count cycles and instructions
+	bool hardware() const { return hw; }
+
+	// Returns instructions per cycle, cache misses per 1000 instructions
+	// (both -1 without a hardware PMU) and page faults [1/s], over all
+	// CPUs since the last call, or open()
+	std::array<float, 3> sample(std::chrono::steady_clock::time_point now);
+
+	void close();
+};
+
+// Pressure stall information triggers on /proc/pressure/{cpu,io,memory},
+// checked without blocking, so a burst of contention is noticed
+// in between samples
+class PsiTriggers {
+	private:
+	std::vector<pollfd> fds;
+
+	public:
+	// Sets a trigger (e.g. "some 150000 2000000", see the kernel's
+	// accounting/psi docs) on each resource. Returns false if none could
+	// be set, err says why.
+	bool open(const std::string &trigger, std::string &err);
+
+	// Returns true if any trigger has fired since the last call
+	bool fired();
+
+	bool isOpen() const { return !fds.empty(); }
+
+	void close();
+};
+
+#endif
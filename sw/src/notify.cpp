@@ -0,0 +1,60 @@
+// -------------------------------------------------------------------------
+// Service manager notifications
+//
+// notify.cpp: readiness and watchdog notifications for systemd
+// See sd_notify(3) for the protocol, which is a datagram per message.
+//
+// Website: https://github.com/tomek-szczesny/pistackmon
+// Authors: Tomek Szczesny, Bernhard Bablok
+// License: GPL3
+// -------------------------------------------------------------------------
+
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+
+#include <unistd.h>		// getpid()
+#include <sys/socket.h>		// socket(), sendto()
+#include <sys/un.h>		// sockaddr_un
+
+#include "notify.h"
+
+// Socket is created on first use, and kept for watchdog keepalives
+static int notify_fd = -1;
+
+//  -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -
+
+bool sdNotify(const char *state) {
+	const char *path = std::getenv("NOTIFY_SOCKET");
+	if (!path || !*path) return false;
+
+	sockaddr_un addr;
+	std::memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	size_t len = std::strlen(path);
+	if (len >= sizeof(addr.sun_path)) return false;
+	if (path[0] != '/' && path[0] != '@') return false;
+	std::memcpy(addr.sun_path, path, len);
+	if (path[0] == '@') addr.sun_path[0] = 0;	// abstract namespace
+
+	if (notify_fd == -1) {
+		notify_fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+		if (notify_fd == -1) return false;
+	}
+	socklen_t addr_len = offsetof(sockaddr_un, sun_path) + len;
+	return sendto(notify_fd, state, std::strlen(state), MSG_NOSIGNAL,
+		      reinterpret_cast<sockaddr *>(&addr), addr_len) >= 0;
+}
+
+//  -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -
+
+std::chrono::microseconds sdWatchdog() {
+	// WATCHDOG_PID, if set, tells which process the watchdog is meant for
+
+	const char *usec = std::getenv("WATCHDOG_USEC");
+	if (!usec) return std::chrono::microseconds(0);
+	const char *pid = std::getenv("WATCHDOG_PID");
+	if (pid && std::strtol(pid, nullptr, 10) != getpid())
+		return std::chrono::microseconds(0);
+	return std::chrono::microseconds(std::strtoull(usec, nullptr, 10));
+}
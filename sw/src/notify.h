@@ -0,0 +1,25 @@
+// -------------------------------------------------------------------------
+// Service manager notifications
+//
+// notify.h: readiness and watchdog notifications for systemd,
+// without linking libsystemd
+//
+// Website: https://github.com/tomek-szczesny/pistackmon
+// Authors: Tomek Szczesny, Bernhard Bablok
+// License: GPL3
+// -------------------------------------------------------------------------
+
+#ifndef _NOTIFY_H
+#define _NOTIFY_H
+
+#include <chrono>
+
+// Sends a state string (e.g. "READY=1") to the service manager over
+// $NOTIFY_SOCKET. Returns false if not started with one, or on failure.
+bool sdNotify(const char *state);
+
+// Returns how often "WATCHDOG=1" must be sent to the service manager,
+// or 0 if the watchdog is not enabled for this process.
+std::chrono::microseconds sdWatchdog();
+
+#endif
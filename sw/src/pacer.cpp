@@ -0,0 +1,40 @@
+// -------------------------------------------------------------------------
+// Pacer
+//
+// pacer.cpp: adapts the sampling rate to how fast measurements change
+//
+// Website: https://github.com/tomek-szczesny/pistackmon
+// Authors: Tomek Szczesny, Bernhard Bablok
+// License: GPL3
+// -------------------------------------------------------------------------
+
+#include <algorithm>
+#include <cmath>
+
+#include "pacer.h"
+
+int Pacer::update(const Config &c, int base, const float *levels, size_t n) {
+	// The first sample, and the first one with another set of sources,
+	// has nothing to compare against, so it counts as a jump
+
+	count++;
+	float change = 1;
+	if (last.size() == n) {
+		change = 0;
+		for (size_t i = 0; i < n; i++)
+			change = std::max(change, std::fabs(levels[i] - last[i]));
+	}
+	last.assign(levels, levels + n);
+
+	int ceiling = std::max(base, static_cast<int>(
+			std::lround(c.refresh_rate / c.sample_min_rate)));
+	if (!c.adaptive_sampling || change * 100 >= c.sample_jump) {
+		interval = base;
+	} else if (change * 100 > c.sample_dead_band) {
+		interval /= 2;
+	} else {
+		interval *= 2;
+	}
+	interval = std::min(std::max(interval, base), ceiling);
+	return interval;
+}
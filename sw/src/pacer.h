@@ -0,0 +1,54 @@
+// -------------------------------------------------------------------------
+// Pacer
+//
+// pacer.h: adapts the sampling rate to how fast measurements change
+//
+// Website: https://github.com/tomek-szczesny/pistackmon
+// Authors: Tomek Szczesny, Bernhard Bablok
+// License: GPL3
+// -------------------------------------------------------------------------
+
+#ifndef _PACER_H
+#define _PACER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "config.h"
+
+class Pacer {
+	// An idle node reads /proc twice a second for nothing, a busy one
+	// could use samples more often than that. Pacer watches consecutive
+	// samples, each source as a fraction of its full scale:
+	// - all of them within sample_dead_band double the interval, up to
+	//   that of sample_min_rate,
+	// - any beyond the dead band halves it,
+	// - any changed by sample_jump or more, or an event (see wake()),
+	//   brings the full rate back at once.
+	// Intervals are whole refresh cycles, the full rate being one sample
+	// every ref_div cycles, as adjusted by the governor.
+
+	private:
+	int interval = 1;		// [refresh cycles]
+	std::vector<float> last;
+	uint64_t count = 0;
+
+	public:
+
+	// Feeds a sample, levels are sources as fractions of full scale.
+	// base - refresh cycles between samples at full rate.
+	// Returns refresh cycles until the next sample.
+	int update(const Config &c, int base, const float *levels, size_t n);
+
+	// An event calling for full rate, e.g. the user LED has changed
+	void wake(int base) { interval = base; }
+
+	// Refresh cycles between samples
+	int div() const { return interval; }
+
+	// Samples fed so far
+	uint64_t samples() const { return count; }
+};
+
+#endif
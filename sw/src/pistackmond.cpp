@@ -6,7 +6,9 @@
 // License: GPL3
 // -------------------------------------------------------------------------
 
-#include <bitset>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
 #include <chrono>
 #include <cmath>
 #include <fstream>
@@ -24,9 +26,23 @@
 #include <unistd.h>	// close(), getopt()
 #include <sys/mman.h>   // mmap()
 #include <sys/stat.h>   // fchmod()
+#include <sys/file.h>   // flock()
+#include <sys/inotify.h> // inotify_init1()
 #include <pthread.h>	// pthread_setschedparam()
 
-#include "gpio.h"       // this is a makefile-generated file (link)
+#include "clock.h"
+#include "config.h"
+#include "fan.h"
+#include "governor.h"
+#include "metrics.h"
+#include "render.h"
+#include "selfstats.h"
+#include "notify.h"
+#include "pacer.h"
+#include "pwm.h"
+#include "record.h"
+#include "driver.h"
+#include "pistackmond.h"
 
 using namespace std::chrono_literals;
 
@@ -36,143 +52,200 @@ using namespace std::chrono_literals;
 class floatLP {
 	// Acts like a float variable, but internally
 	// filters its contents every time it is updated.
-	// Must be updated at the same rate to be effective.
+	// Updates may come at any interval, each one weighs as much
+	// as the time it stands for.
 
 	private:
 	float z = 0;			// The variable
+	float tau = 1;			// Time constant
+	float alpha_dt = 0;		// Interval alpha is worked out for
 	float alpha = 1;		// Smoothing factor
 
 	public:
 
-	// z - initial value
 	// tau - time constant [s]
-	// freq - sampling frequency
-	floatLP(float tau, float freq, float z = 0) {
+	// z - initial value
+	floatLP(float tau, float z = 0) {
 		this->z = z;
-		this->alpha = 1 - (std::exp(-1/(freq * tau)));
+		this->tau = tau;
 	}
 
-	floatLP operator=(float z0) {
+	// Feeds a new value, dt [s] after the previous one
+	void update(float z0, float dt) {
+		if (dt != alpha_dt) {
+			alpha_dt = dt;
+			alpha = 1 - std::exp(-dt / tau);
+		}
 		z = (alpha * z0) + ((1 - alpha) * z);
-		return *this;
 	}
 
+	// Sets the filtered value straight away, skipping the transient
+	void reset(float z0) { z = z0; }
+
 	float f() { return z; }
 
 };
 
 //=================================== CONSTS ===================================
 
-// Data refreshing rate
-const float refresh_rate = 10;				// Hz
-const std::chrono::microseconds refresh_period =
-	std::chrono::microseconds(static_cast<uint32_t>(1000000/refresh_rate));
-
-// Refresh divider - the actual data sampling is performed only once in ref_div,
-// although data smoothing is performed on every refresh cycle.
-const int ref_div = 5;
-
-// LSB period of a PWM driver.
-// Generally should be kept under 20ms/(2^pwm_res) for PWM operation above 50Hz
-// for the LED intensity to appear smooth.
-// Smaller values are possible at the expense of CPU load and accuracy.
-// Values under 10us are not recommended due to thread sleep accuracy.
-// For mathematical consistency it should be an integer, but you do you.
-const float pwm_lsb_period = 50;			// [us]
-
-// bit depth of PWM LED driver (2-16)
-const int pwm_res = 8;
-
-// Layout vectors, containing positions of each LED in LED driver register
-const std::vector<int> cpu_layout = {4, 3, 2, 1, 0};
-const std::vector<int> ram_layout = {9, 8, 7, 6, 5};
-const std::vector<int> temp_layout = {11, 10, 12, 13, 14};
-const std::vector<int> user_layout = {15};
-
-// Led intensities adjusted by color 
-// Depending on LED make and model, some colors might appear brighter than others
-// Consts below may be used to equalize these differences
-// Note: these values are set from the makefile
-const float led_g = LED_G;
-const float led_y = LED_Y;
-const float led_r = LED_R;
-const float led_b = LED_B;
-
-std::vector<float> led_pwm_multipliers = {led_y, led_g, led_g, led_g, led_g,
-						led_r, led_y, led_g, led_g, led_g,
-						led_g, led_g, led_y, led_r, led_r, led_b};
-
-// "Gamma" correction for LEDs
-// This constant is in use by the led_linear() function below.
-// This is not the actual "gamma" correction, but something similar.
-const float led_gamma = LED_GAMMA;
+// Tunables (refresh rate, PWM timing, LED colors, gamma, brightness)
+// are described in config.h and may be changed at runtime.
+// LED layout is described in render.cpp, the PWM thread lives in pwm.cpp.
+
+// Temperature shown as an empty and a full bar [C]
+const float temp_min = 40;
+const float temp_max = 90;
 
 //================================== GLOBALS ===================================
 
+// Active configuration, owned by the main thread
+// run_cfg is cfg adjusted by the governor, the one actually in use.
+// Every load of the config file starts from base_cfg.
+Config cfg;
+Config run_cfg;
+Config base_cfg;
+std::string config_path = CONFIG_PATH;
+Governor governor;
+
 // Variables holding measurement results
 // Numeric arguments are time constants of low pass filters [in seconds]
 // Bigger values will further smooth (and slow down) the response.
-floatLP cpu(0.5, refresh_rate);
-floatLP ram(0.5, refresh_rate);
-floatLP temp(0.5, refresh_rate);
+floatLP cpu(0.5);
+floatLP ram(0.5);
+floatLP temp(0.5);
+floatLP disk(0.5);
+floatLP diskIops(0.5);
+floatLP netRx(0.5);
+floatLP netTx(0.5);
+floatLP ipc(0.5);
+floatLP mpki(0.5);
+floatLP faults(0.5);
+floatLP iowait(0.5);
+floatLP irq(0.5);
+floatLP steal(0.5);
 float   user;
 
-// pwm_data contains data for PWM() thread to work on
-// Each vector item contains 16 bits to be passed to LED driver.
-// Vector items are ordered from the least to most significant bits
-// in terms of PWM modulation.
-// pwm_data_mutex protects pwm_data
-typedef std::vector<std::bitset<16>> pwm_data_datatype;
-pwm_data_datatype pwm_data;
-std::mutex pwm_data_mutex;
-
-// Precalculated PWM periods
-// To be filled by PWM thread
-std::vector<std::chrono::microseconds> pwm_periods;
-
-// Bools signaling the respective threads to stop
-bool pwm_closing = 0;
-bool main_closing = 0;
-
-
-//============================== LED LINEARIZATION =============================
+// Latest measurements, before filtering
+struct Samples {
+	float cpu = 0;			// [%]
+	float iowait = 0;		// [% of CPU time]
+	float irq = 0;			// irq + softirq [% of CPU time]
+	float steal = 0;		// [% of CPU time]
+	float ram = 0;			// [%]
+	float temp = 0;			// [C], -1 if not available
+	float disk = 0;			// [bytes/s]
+	float disk_iops = 0;		// [1/s]
+	float net_rx = 0;		// [bytes/s]
+	float net_tx = 0;		// [bytes/s]
+	float ipc = -1;			// -1 if not counted
+	float mpki = -1;		// -1 if not counted
+	float faults = 0;		// [1/s]
+};
 
-float led_linear(float in) {
-	// A LED linearization algorithm that takes a brightness value (0-1)
-	// and returns duty cycle (also 0-1).
-	// Uses constant "gamma" declared above
+// Source shown on each bar, from run_cfg
+int bar_sources[BARS];
+
+// Block devices and network interfaces, opened with the lists they
+// were opened for
+DiskStats diskstats;
+NetDev netdev;
+std::string open_disks = "";
+std::string open_nets = "";
+
+// Params in use by the main thread, published to the PWM thread
+// (see pwm.h) along with frames rendered with them.
+// Retired sets are freed only after the PWM thread moved on to the newest one.
+const PwmParams *pwm_params = nullptr;
+std::vector<const PwmParams *> pwm_params_retired;
+
+SelfMonitor self_monitor;
+std::string stats_path = STATS_PATH;
+
+// Measurements are recorded here with -r
+Recorder recorder;
+
+// CPU frequency scaling and throttling
+CpuFreq cpufreq;
+float cpuCapacity = 1;
+int throttledFlags = -1;
+
+// Files read on every sample, all in one pass, and indices of those
+// not read through their own classes
+Sampler sampler;
+int sampler_io_uring = -1;		// as opened with
+int src_stat = -1;
+int src_meminfo = -1;
+int src_thermal = -1;
+
+// Fan control. A fan is driven either by the hardware PWM channel
+// fan_channel, or by software PWM of the fan header pin (fan_soft).
+FanController fan;
+PwmChannel fan_channel;
+bool fan_soft = false;
+std::string open_fan_pwm = "";		// channel opened, with its frequency
+float open_fan_freq = 0;
+
+// Performance counters, opened as perf_counters says
+PerfCounters perf;
+int open_perf = 0;
+
+// Sampling rate, and pressure stall triggers calling for the full one
+Pacer pacer;
+PsiTriggers psi;
+std::string open_psi = "";		// trigger set
+
+// Signals the main thread to stop
+bool main_closing = 0;
 
-	float a = 1 / (std::exp(led_gamma) - 1);
-	return a * (std::exp(led_gamma*in) - 1);
-}
+// Set by SIGHUP
+volatile sig_atomic_t reload_pending = 0;
 
 
 //================================ shared-memory ===============================
 
 // Shared-memory region
 #define SHR_MEM_PATH "/pistackmond"
+std::string shr_mem_path = SHR_MEM_PATH;
 void *shrmap;
 const off_t SHR_MEM_SIZE = sizeof(float);
 
+// In create-mode the descriptor stays open, holding an exclusive lock
+// for as long as the daemon runs. A region left over from a crashed daemon
+// holds no lock, which tells it apart from one that is still in use.
+int shrfd = -1;
+
 int openShrMem(int oflags) {
 	int rc;
 	int fd;
 
 	// get shared memory file descriptor
-	fd = shm_open(SHR_MEM_PATH,oflags,S_IRUSR|S_IWUSR);
+	fd = shm_open(shr_mem_path.c_str(),oflags,S_IRUSR|S_IWUSR);
 	if (fd == -1) {
 		perror("shm_open failed");
 		return -1;
 	}
-	// works only after shm_open, since shm_open respects umask
-	fchmod(fd,S_IRUSR|S_IWUSR|S_IRGRP|S_IWGRP|S_IROTH|S_IWOTH);
 
 	// increase the size if in create-mode
 	if (oflags & O_CREAT) {
-		rc = ftruncate(fd,SHR_MEM_SIZE);
+		if (flock(fd,LOCK_EX|LOCK_NB) == -1) {
+			std::cerr << "error: " << shr_mem_path <<
+			  " is in use, is pistackmond already running?" << std::endl;
+			close(fd);
+			return -1;
+		}
+		struct stat st;
+		if (fstat(fd,&st) == 0 && st.st_size > 0) {
+			std::cerr << "Reclaiming stale " << shr_mem_path << std::endl;
+		}
+		// works only after shm_open, since shm_open respects umask
+		fchmod(fd,S_IRUSR|S_IWUSR|S_IRGRP|S_IWGRP|S_IROTH|S_IWOTH);
+		// truncating first discards whatever a stale region held
+		rc = ftruncate(fd,0);
+		if (rc != -1) rc = ftruncate(fd,SHR_MEM_SIZE);
 		if (rc == -1) {
 			perror("ftruncate failed");
-			shm_unlink(SHR_MEM_PATH);
+			shm_unlink(shr_mem_path.c_str());
+			close(fd);
 			return -1;
 		}
 	}
@@ -183,7 +256,11 @@ int openShrMem(int oflags) {
 	} else {
 		shrmap = mmap(NULL,SHR_MEM_SIZE,PROT_READ,MAP_SHARED,fd,0);
 	}
-	close(fd);
+	if (oflags & O_CREAT) {
+		shrfd = fd;
+	} else {
+		close(fd);
+	}
 	return 0;
 }
 
@@ -205,7 +282,11 @@ inline void writeShrMem(std::string str) {
 void closeShrMem(bool unlink=false) {
 	munmap(shrmap,SHR_MEM_SIZE);
 	if (unlink) {
-		shm_unlink(SHR_MEM_PATH);
+		shm_unlink(shr_mem_path.c_str());
+	}
+	if (shrfd != -1) {
+		close(shrfd);		// releases the lock
+		shrfd = -1;
 	}
 }
 
@@ -214,11 +295,21 @@ void closeShrMem(bool unlink=false) {
 std::string arg_cmd = "";
 std::string arg_user = "";
 std::string arg_brightness = "";
+std::string arg_config = "";
+std::string arg_record = "";
+std::string arg_file = "";
+std::string arg_root = "";
 bool arg_service = false;
 
 void help(char* pgm) {
 	std::cerr << "usage: " << pgm << " -u USER_LED" << std::endl <<
 	  "where USER_LED is the brightness of a blue user LED on PiStackMon Lite (range: 0-1)" << std::endl <<
+	  "       " << pgm << " -s [-b BRIGHTNESS] [-c CONFIG] [-r RECORDING] [-R ROOT]" << std::endl <<
+	  "runs the service, CONFIG defaults to " << CONFIG_PATH << "," << std::endl <<
+	  "measurements are written to RECORDING if given," << std::endl <<
+	  "and taken from ROOT/proc and ROOT/sys if given" << std::endl <<
+	  "       " << pgm << " [-c CONFIG] replay RECORDING" << std::endl <<
+	  "prints frames rendered from a recording" << std::endl <<
 	  "For more advanced options see README.md" << std::endl;
 	exit(3);
 }
@@ -227,7 +318,7 @@ void parseArgs(int argc, char*argv[]) {
 	int c;
 	opterr = 0;
 
-	while ((c = getopt (argc,argv,"sb:u:h")) != -1) {
+	while ((c = getopt (argc,argv,"sb:c:r:R:u:h")) != -1) {
 		switch (c) {
 			case 's':
 			arg_service = true;
@@ -235,6 +326,15 @@ void parseArgs(int argc, char*argv[]) {
 		case 'b':
 			arg_brightness = std::string(optarg);
 			break;
+		case 'c':
+			arg_config = std::string(optarg);
+			break;
+		case 'r':
+			arg_record = std::string(optarg);
+			break;
+		case 'R':
+			arg_root = std::string(optarg);
+			break;
 		case 'u':
 			arg_user = std::string(optarg);
 			break;
@@ -242,7 +342,8 @@ void parseArgs(int argc, char*argv[]) {
 	  		help(argv[0]);
 	  		break;
 		case '?':
-			if (optopt == 'b' || optopt == 'u') {
+			if (optopt == 'b' || optopt == 'c' || optopt == 'r' ||
+			    optopt == 'R' || optopt == 'u') {
 				std::cerr << "error: option -" << optopt << 
 				  " requires an argument" << std::endl;
 				help(argv[0]);
@@ -259,457 +360,813 @@ void parseArgs(int argc, char*argv[]) {
 	if (optind < argc) {
 		arg_cmd = argv[optind];
 	}
+	if (optind + 1 < argc) {
+		arg_file = argv[optind + 1];
+	}
 }
 
-//=================================== MISC =====================================
+inline float fetchUser() {
+	// read user-value from shared-memory
+	return readShrMem();
+}
 
-std::vector<long int> getIntsFromLine(std::string s) {
-	// Returns all integers found in a given string
+// ============================== CONFIG RELOAD ================================
 
-	std::string temp_s;
-	long int temp_i;
-	std::stringstream ss;
-	std::vector<long int> output;
+int config_watch = -1;
 
-	ss << s;
+void watchConfig() {
+	// Watches the directory holding the config file, since editors
+	// tend to replace files rather than write to them.
+	// Events are polled by configChanged() from the main loop.
 
-	// Reading values from ss one by one, and discarding those that
-	// cannot be converted to int.
-	while (!ss.eof()) {
-		ss >> temp_s;
-		if (std::stringstream(temp_s) >> temp_i) {
-			output.push_back(temp_i);
-		}
+	config_watch = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (config_watch == -1) {
+		perror("inotify_init1 failed");
+		return;
+	}
+	size_t slash = config_path.rfind('/');
+	std::string dir = (slash == std::string::npos) ? "." :
+			  (slash == 0) ? "/" : config_path.substr(0, slash);
+	if (inotify_add_watch(config_watch, dir.c_str(),
+				IN_CLOSE_WRITE | IN_MOVED_TO) == -1) {
+		perror("inotify_add_watch failed");
+		close(config_watch);
+		config_watch = -1;
 	}
-	return output;
 }
 
-//================================ DATA SOURCES ================================
+//  -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   
 
-float fetchTemp() {
-	// Returns CPU temperature in degrees C
+bool configChanged() {
+	// Returns true if the config file has been written since the last call
 
-	const std::string temp_file_name = 
-			"/sys/devices/virtual/thermal/thermal_zone0/temp";
+	if (config_watch == -1) return false;
 
-	std::ifstream temp_file(temp_file_name);
+	alignas(inotify_event) char buf[4096];
+	std::string name = config_path.substr(config_path.rfind('/') + 1);
+	bool changed = false;
+	ssize_t len;
 
-	if(!temp_file.is_open()) {
-          	std::fprintf(stderr,"Unable to open %s.\n",
-						temp_file_name.c_str());
-		return -1.0;
+	while ((len = read(config_watch, buf, sizeof(buf))) > 0) {
+		for (char *ptr = buf; ptr < buf + len; ) {
+			auto *ev = reinterpret_cast<inotify_event *>(ptr);
+			if (ev->len && name == ev->name) changed = true;
+			ptr += sizeof(inotify_event) + ev->len;
+		}
 	}
+	return changed;
+}
+
+//  -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   
 
-	float result;
-	temp_file >> result;
-	temp_file.close();
-	result /= 1000;
-	return result;	
+void applyConfig() {
+	// Rebuilds derived tables off the PWM thread.
+	// Called on config reload and governor level change.
+	// The new PwmParams is published by the main loop along with
+	// the next pwm_data frame.
+
+	run_cfg = governor.apply(cfg);
+	pwm_params_retired.push_back(pwm_params);
+	pwm_params = buildPwmParams(run_cfg);
+
+	bar_sources[BAR_CPU] = sourceByName(run_cfg.bar_cpu);
+	bar_sources[BAR_RAM] = sourceByName(run_cfg.bar_ram);
+	bar_sources[BAR_TEMP] = sourceByName(run_cfg.bar_temp);
+	std::vector<std::string> ext = splitList(run_cfg.bar_ext);
+	for (int b = 0; b < EXT_BARS; b++) {
+		bar_sources[BAR_EXT + b] = b < static_cast<int>(ext.size()) ?
+					   sourceByName(ext[b]) : SRC_NONE;
+	}
 }
 
-//------------------------------------------------------------------------------
-
-float fetchCpu() {
-	// Returns CPU load in %.
-	// It's a mean value for all cores,
-	// and a mean value since the last call of this method.
-	// 
-	// /proc/stat contains counters of CPU time dedicated to various tasks.
-	// Fourth column is the CPU idle time.
-	// This function computes how much time CPUs were *not* idle.
-	//
-	// Too frequent calling (< 50ms) yields results with poor resolution,
-	// due to kernel counters working typically at 100Hz.
-	// It is recommended to apply some sort of low-pass filter
-	// for more meaningful long-term results.
-
-	static std::vector<long int> last_stat;
-	std::vector<long int> current_stat;
-	int temp_i = 0;
-	std::string temp_s;
-
-repeat:
-
-	std::ifstream cpu_file("/proc/stat");
-	if(!cpu_file.is_open()) {
-          	std::fprintf(stderr,"Unable to open /proc/stat. Quitting!\n");
-		exit(-1);
-	}
-
-	getline(cpu_file, temp_s);
-	cpu_file.close();
-	current_stat = getIntsFromLine(temp_s);
-
-	// On first run, the last_stat vector is empty,
-	// so it needs to be populated by repeating the whole thing.
-	if (last_stat.empty()) {
-		last_stat = current_stat;
-		std::this_thread::sleep_for(50ms);	
-		goto repeat;
-	}
-
-	float result = 0;
-	for (auto item : current_stat) temp_i+= item;
-	for (auto item : last_stat) temp_i-= item;
-	
-	// This might happen if called too soon after last call
-	// The result would be division by zero - nan.
-	if (temp_i == 0) {
-		std::this_thread::sleep_for(50ms);	
-		goto repeat;
+//  -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   
+
+void openIoSources() {
+	// (Re)opens block devices and network interfaces, if their lists
+	// have changed. Names are interned here, not on every sample.
+
+	if (cfg.disk_devices != open_disks) {
+		diskstats.close();
+		diskstats.open(fs_root + "/proc/diskstats", splitList(cfg.disk_devices));
+		open_disks = cfg.disk_devices;
+	}
+	if (cfg.net_interfaces != open_nets) {
+		netdev.close();
+		netdev.open(fs_root + "/proc/net/dev", splitList(cfg.net_interfaces));
+		open_nets = cfg.net_interfaces;
 	}
-	
-	// The fourth column represents CPU idle time
-	result = current_stat.at(3) - last_stat.at(3);
-	result /= temp_i;
-	result = 1 - result;
-	result *= 100;
-
-	last_stat = current_stat;
-	return result;	
 }
 
-//------------------------------------------------------------------------------
+//  -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   
 
-float fetchRam() {
-	// Returns percentage of used RAM.
-	// Used memory estimated just like "free" does:
-	// MemTotal - MemFree - Buffers - Cached - SReclaimable
-	// See "man free" for details.
-	
-	int memtotal = 1;
-
-	std::string temp_s;
-	float result = 0;
-
-
-	std::ifstream mem_file("/proc/meminfo");
-	if(!mem_file.is_open()) {
-          	std::fprintf(stderr,"Unable to open /proc/meminfo. Quitting!\n");
-		exit(-1);
-	}
-
-	while (!mem_file.eof()) {
-		getline(mem_file, temp_s);
-		//TODO: Replace with "starts_with" when it gets around)
-		if 	(temp_s.find("MemTotal:") == 0)
-			memtotal = getIntsFromLine(temp_s).at(0);
-		else if	(temp_s.find("MemFree:") == 0)
-			result -= getIntsFromLine(temp_s).at(0);
-		else if	(temp_s.find("Buffers:") == 0)
-			result -= getIntsFromLine(temp_s).at(0);
-		else if	(temp_s.find("Cached:") == 0)
-			result -= getIntsFromLine(temp_s).at(0);
-		else if	(temp_s.find("SReclaimable:") == 0)
-			result -= getIntsFromLine(temp_s).at(0);
-	}
-	mem_file.close();
-
-	result /= memtotal;
-	result += 1;
-	result *= 100;
-	return result;
+void openSampler() {
+	// (Re)builds the set of files read on every sample.
+	// Called after openIoSources(), which may have reopened tables.
+
+	if (cfg.io_uring != sampler_io_uring) {
+		std::string err;
+		if (!sampler.open(cfg.io_uring, err)) {
+			std::cerr << "io_uring not available (" << err <<
+			  "), sampling with pread()" << std::endl;
+		}
+		sampler_io_uring = cfg.io_uring;
+	}
+	sampler.clear();
+	src_stat = sampler.add(fs_root + "/proc/stat");
+	src_meminfo = sampler.add(fs_root + "/proc/meminfo");
+	src_thermal = sampler.add(fs_root + THERMAL_PATH, 32);
+	if (src_thermal == -1) {
+		std::cerr << "Unable to open " << fs_root << THERMAL_PATH <<
+		  "." << std::endl;
+	}
+	cpufreq.addTo(sampler);
+	diskstats.addTo(sampler);
+	netdev.addTo(sampler);
 }
 
-inline float fetchUser() {
-	// read user-value from shared-memory
-	return readShrMem();
+//  -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   
+
+void openPerf() {
+	// Opens or closes performance counters, if perf_counters has changed
+
+	if (cfg.perf_counters == open_perf) return;
+	perf.close();
+	std::string err;
+	if (cfg.perf_counters && !perf.open(err)) {
+		std::cerr << "Performance counters not available (" << err <<
+		  ")" << std::endl;
+	} else if (perf.isOpen() && !perf.hardware()) {
+		std::cerr << "No hardware performance counters, counting page "
+		  "faults only" << std::endl;
+	}
+	open_perf = cfg.perf_counters;
 }
 
-// ================================ LED DRIVING ================================
+//  -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   
 
-std::vector<float> led_pwms() {
-	// converts fetched numbers into float PWM values of each LED
-	// Includes LED PWM multipliers (for intensity correcton or whatever)
-	// Also includes gamma correction
-	
-	std::vector<float> output(16);
+void openPsi() {
+	// (Re)sets pressure stall triggers, if the trigger has changed
 
-	for (int i=0; i<5; i++) {
-		if (cpu.f() >= 20*(i+1)) output[cpu_layout[i]] = 1;
-		else {
-			output[cpu_layout[i]] = led_linear((cpu.f() - (20*i))/20);
-			break;
-		}
+	std::string trigger = cfg.adaptive_sampling ? cfg.sample_psi : "";
+	if (trigger == open_psi) return;
+	psi.close();
+	std::string err;
+	if (trigger != "" && !psi.open(trigger, err)) {
+		std::cerr << "Pressure stall triggers not available (" << err <<
+		  ")" << std::endl;
 	}
+	open_psi = trigger;
+}
 
-	for (int i=0; i<5; i++) {
-		if (ram.f() >= 20*(i+1)) output[ram_layout[i]] = 1;
-		else {
-			output[ram_layout[i]] = led_linear((ram.f() - (20*i))/20);
-			break;
+//  -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   
+
+void openFan() {
+	// (Re)opens the hardware PWM channel of the fan if its settings
+	// have changed, otherwise the fan is left to the PWM thread.
+
+	std::string channel = cfg.fan ? cfg.fan_pwm : "";
+	if (channel != open_fan_pwm || cfg.fan_pwm_frequency != open_fan_freq) {
+		fan_channel.close();
+		std::string err;
+		if (channel != "" &&
+		    !fan_channel.open(fs_root + "/sys/class/pwm/" + channel,
+				      cfg.fan_pwm_frequency, err)) {
+			std::cerr << "Fan PWM not available (" << err <<
+			  "), fan stays off" << std::endl;
 		}
+		open_fan_pwm = channel;
+		open_fan_freq = cfg.fan_pwm_frequency;
 	}
-	if (temp.f() > 40) {
-		for (int i=0; i<5; i++) {
-			if (temp.f() >= 10*(i+1)+40) output[temp_layout[i]] = 1;
-			else {
-				output[temp_layout[i]] = led_linear((temp.f() - (10*i+40))/10);
-				break;
-			}
-		}
+	fan_soft = cfg.fan && channel == "";
+#ifndef GPIO_FAN
+	if (fan_soft) {
+		std::cerr << "No fan pin on this platform, fan stays off "
+		  "unless driven by fan_pwm" << std::endl;
+		fan_soft = false;
 	}
+#endif
+}
 
-	output[user_layout[0]] = led_linear(user);
-	for (int i=0; i<16; i++) output[i] *= led_pwm_multipliers[i];
+//  -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   
+
+void updateFan(const Samples &s, Clock::time_point now) {
+	// Runs the fan controller on the filtered temperature, the one
+	// the temperature bar shows
 
-	return output;
+	float duty = fan.update(cfg, s.temp < 0 ? -1 : temp.f(), now);
+	fan_channel.set(duty);
 }
 
 //  -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   
 
-pwm_data_datatype format_pwms(std::vector<float> pwms) {
-	// Converts float pwms of each LED into a vector of bitsets.
-	
-	std::vector<std::bitset<pwm_res>> pwms_digitized;
-	pwm_data_datatype output;
-	std::bitset<16> temp_data;
+float softwareFan() {
+	// Fan duty for the PWM thread (0-1), -1 if it drives no fan
 
-	for (auto f : pwms) {
-		pwms_digitized.push_back(static_cast<uint16_t>(f*(std::pow(2,pwm_res)-1)));
-	}
-	for (int i=0; i < pwm_res; i++) {
-		temp_data.reset();
-		for (int j = 0; j < 16; j++) {
-			temp_data[j] = pwms_digitized[j][i];
+	return fan_soft ? fan.duty() / 100 : -1;
+}
+
+//  -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   
+
+void freeRetiredParams() {
+	// Once PWM thread runs with the newest params,
+	// it can never pick up any of the older ones again.
+
+	if (pwm_params_retired.empty()) return;
+	if (pwm_params_used.load() != pwm_params) return;
+	for (auto p : pwm_params_retired) delete p;
+	pwm_params_retired.clear();
+}
+
+//================================= SAMPLING ===================================
+
+float sampleCpu() {
+	// Returns CPU load in %, scaled by CPU frequency if configured.
+	// Capacity and throttling flags are refreshed in the same pass.
+	// Files are those of the last sampler pass.
+
+	const char *stat = sampler.data(src_stat);
+	float busy = stat ? cpuFromStat(stat) : fetchCpu();
+	cpuCapacity = cpufreq.capacity(&sampler);
+
+	int flags = cpufreq.throttled(&sampler);
+	if ((flags & THROTTLED_NOW) != (throttledFlags & THROTTLED_NOW)) {
+		if (flags & THROTTLED_NOW) {
+			std::cerr << "Throttling:" <<
+			  (flags & THROTTLED_UNDERVOLT ? " under-voltage" : "") <<
+			  (flags & THROTTLED_FREQ_CAP ? " frequency capped" : "") <<
+			  (flags & THROTTLED_THROTTLED ? " throttled" : "") <<
+			  (flags & THROTTLED_SOFT_TEMP ? " soft temperature limit" : "") <<
+			  std::endl;
+		} else if (throttledFlags > 0) {
+			std::cerr << "Throttling is over" << std::endl;
 		}
-		output.push_back(temp_data);
 	}
-	return output;
+	throttledFlags = flags;
 
+	if (!run_cfg.cpu_freq_scale) return busy;
+	return 100 - (100 - busy) * cpuCapacity;
+}
+
+//================================ RENDERING ===================================
+
+float sourceFill(int source) {
+	// Returns the part of a bar filled by a source (0-1),
+	// from filtered measurements
+
+	switch (source) {
+	case SRC_CPU:       return cpu.f() / 100;
+	case SRC_RAM:       return ram.f() / 100;
+	case SRC_TEMP:      return (temp.f() - temp_min) / (temp_max - temp_min);
+	case SRC_DISK:      return disk.f() / run_cfg.disk_full_scale;
+	case SRC_DISK_IOPS: return diskIops.f() / run_cfg.disk_iops_full_scale;
+	case SRC_NET:       return (netRx.f() + netTx.f()) / run_cfg.net_full_scale;
+	case SRC_NET_RX:    return netRx.f() / run_cfg.net_full_scale;
+	case SRC_NET_TX:    return netTx.f() / run_cfg.net_full_scale;
+	case SRC_IPC:       return ipc.f() / run_cfg.ipc_full_scale;
+	case SRC_MPKI:      return mpki.f() / run_cfg.mpki_full_scale;
+	case SRC_FAULTS:    return faults.f() / run_cfg.faults_full_scale;
+	case SRC_CPU_NOIO:  return (cpu.f() - iowait.f()) / 100;
+	case SRC_IOWAIT:    return iowait.f() / 100;
+	case SRC_IRQ:       return irq.f() / 100;
+	case SRC_STEAL:     return steal.f() / 100;
+	case SRC_CPU_SPLIT: return cpu.f() / 100;
+	default:            return 0;
+	}
 }
 
 //  -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   
 
-void sendFrame16(std::bitset<16> f) {
-	// Sends data to LED driver chip but does not latch it
-	for(int i = 0; i < 16; i++) {
-		__sync_synchronize();
-		gpioClear(PIN_CLK);
-		if (f[15-i]) {
-                	gpioSet(PIN_DATA);
-		} else {
-                	gpioClear(PIN_DATA);
-		}
-		__sync_synchronize();
-		gpioSet(PIN_CLK);
+pwm_data_datatype renderFrame(const Samples &s, float userSample, float dt) {
+	// Filters the latest measurements and renders a frame from them.
+	// Called once per refresh cycle, by both the main loop and replay(),
+	// dt [s] after the previous one. Samples are held in between,
+	// however long the sampling interval is.
+
+	user = userSample;
+	cpu.update(s.cpu, dt);
+	ram.update(s.ram, dt);
+	temp.update(s.temp < 0.0 ? 0.0:s.temp, dt);
+	disk.update(s.disk, dt);
+	diskIops.update(s.disk_iops, dt);
+	netRx.update(s.net_rx, dt);
+	netTx.update(s.net_tx, dt);
+	ipc.update(std::max(s.ipc, 0.0f), dt);
+	mpki.update(std::max(s.mpki, 0.0f), dt);
+	faults.update(s.faults, dt);
+	iowait.update(s.iowait, dt);
+	irq.update(s.irq, dt);
+	steal.update(s.steal, dt);
+
+	// A split bar is dimmed above CPU load less iowait
+	bar_fills_datatype fills;
+	bar_splits_datatype splits;
+	for (int b = 0; b < BARS; b++) {
+		fills[b] = sourceFill(bar_sources[b]);
+		splits[b] = bar_sources[b] == SRC_CPU_SPLIT ?
+			    sourceFill(SRC_CPU_NOIO) : 1;
 	}
+	return format_pwms<CHAIN_WIDTH>(led_pwms(*pwm_params, fills, user, &splits));
 }
 
 //  -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   
 
-inline void commitFrame() {
-	// Applies latch pulse to LED driver chip
-	// Thus applying whatever has been previously sent to it
-	// Keeping these separated helps synchronise PWM more precisely
-
-	__sync_synchronize();
-	gpioSet(PIN_LATCH);
-	__sync_synchronize();
-	gpioClear(PIN_LATCH);
-	__sync_synchronize();
+void seedFilters(const Samples &s) {
+	// Starts filters right at the first measurements, so the first frame
+	// shows them instead of bars rising from zero
+
+	cpu.reset(s.cpu);
+	ram.reset(s.ram);
+	temp.reset(s.temp < 0.0 ? 0.0:s.temp);
+	disk.reset(s.disk);
+	diskIops.reset(s.disk_iops);
+	netRx.reset(s.net_rx);
+	netTx.reset(s.net_tx);
+	ipc.reset(std::max(s.ipc, 0.0f));
+	mpki.reset(std::max(s.mpki, 0.0f));
+	faults.reset(s.faults);
+	iowait.reset(s.iowait);
+	irq.reset(s.irq);
+	steal.reset(s.steal);
 }
 
 //  -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   
 
-void gpioInit() {
-	gpioInitImpl();     // platform-specific implementation
-	sendFrame16(0);     // clear all LEDs
-	commitFrame();
+void sampleFiles(Samples &s) {
+	// Reads every file of a sample in one pass, then parses CPU load
+	// and its breakdown, RAM usage and temperature.
+	// Those not read keep their last values.
+
+	sampler.read();
+	s.cpu = sampleCpu();
+	// With frequency scaling, shares of CPU time are of the capacity
+	// the CPU load is, so cpu_noio subtracts like from like
+	const CpuTimes &times = cpuTimes();
+	float scale = run_cfg.cpu_freq_scale ? cpuCapacity : 1;
+	s.iowait = times.iowait * scale;
+	s.irq = (times.irq + times.softirq) * scale;
+	s.steal = times.steal * scale;
+	if (const char *m = sampler.data(src_meminfo)) s.ram = ramFromMeminfo(m);
+	if (src_thermal == -1) {
+		s.temp = -1;
+	} else if (const char *t = sampler.data(src_thermal)) {
+		s.temp = tempFromSysfs(t);
+	}
 }
 
 //  -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   
 
-void setLedState(bool state = true) {
-	__sync_synchronize();
-	if (state) {
-		gpioClear(PIN_BLANK);
-        } else {
-		gpioSet(PIN_BLANK);
-        }
-	__sync_synchronize();
+int paceSampling(const Samples &s) {
+	// Hands the latest sample to the pacer, every source as a fraction
+	// of its full scale. Returns refresh cycles until the next sample.
+
+	const float levels[] = {
+		s.cpu / 100,
+		s.iowait / 100,
+		s.irq / 100,
+		s.steal / 100,
+		s.ram / 100,
+		(s.temp - temp_min) / (temp_max - temp_min),
+		s.disk / run_cfg.disk_full_scale,
+		s.disk_iops / run_cfg.disk_iops_full_scale,
+		s.net_rx / run_cfg.net_full_scale,
+		s.net_tx / run_cfg.net_full_scale,
+		std::max(s.ipc, 0.0f) / run_cfg.ipc_full_scale,
+		std::max(s.mpki, 0.0f) / run_cfg.mpki_full_scale,
+		s.faults / run_cfg.faults_full_scale,
+	};
+	return pacer.update(cfg, run_cfg.ref_div, levels,
+			    sizeof(levels) / sizeof(levels[0]));
 }
 
-//  -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -
-
-void gpioDeinit(bool noclear = false) {
+//  -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   
 
-	if (!noclear) {
-		sendFrame16(0);		// Turn all them LEDs off
-		commitFrame();
-	}
-	gpioDeinitImpl();
+void sampleIo(Samples &s, Clock::time_point now) {
+	// Refreshes I/O rates of the devices in use, if any,
+	// from tables of the last sampler pass
+
+	if (open_disks.empty() && open_nets.empty()) return;
+	std::array<float, 2> r = diskstats.sample(now, &sampler);
+	s.disk = r[0];
+	s.disk_iops = r[1];
+	r = netdev.sample(now, &sampler);
+	s.net_rx = r[0];
+	s.net_tx = r[1];
+	recorder.io(now, s.disk, s.disk_iops, s.net_rx, s.net_tx);
 }
 
 //  -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   
 
-void PWM() {
-	// This is a process intended to run as a separate thread
-	// for the sake of simplicity. Really.
-	// It reads pwm_data and executes whatever is in there.
-	// In order to kill this thread gracefully, set "pwm_closing" to 1. 
+void samplePerf(Samples &s, Clock::time_point now) {
+	// Refreshes performance counter metrics, if counting.
+	// Each CPU's group is one read() of its own, not a sampler file.
 
-	auto next_step = std::chrono::high_resolution_clock::now();
-	pwm_data_datatype local_pwm_data;
+	if (!perf.isOpen()) return;
+	std::array<float, 3> r = perf.sample(now);
+	s.ipc = r[0];
+	s.mpki = r[1];
+	s.faults = r[2];
+	recorder.perf(now, s.ipc, s.mpki, s.faults);
+}
 
-	gpioInit();
-	setLedState(true);
+//  -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   
 
-	// Compute PWM periods for each bit
-	// Every more significant bit gets twice the time of the previous one
-	for (int i = 0; i < pwm_res; i++) {
-		pwm_periods.push_back(std::chrono::microseconds(
-				static_cast<uint32_t>(pwm_lsb_period*std::pow(2,i))));
-	}
-	
-	/*
-	// Initial LED test
-	for (int i = 0; i < 16; i++) {
-		sendFrame16(1 << i);
-		commitFrame();
-		std::this_thread::sleep_for(150ms);	
+int replay(const std::string &path) {
+	// Feeds a recording through the rendering pipeline on a virtual clock,
+	// one frame per refresh period, as fast as it goes.
+	// Every frame is printed as a line: time since the start of recording
+	// [s], then pwm_res bitplanes in hex, the least significant one first.
+	// Rendering depends on the config, so use the one the recording was
+	// made with, or the one to be compared.
+
+	Player player;
+	if (!player.open(path)) {
+		std::cerr << "error: " << player.err << std::endl;
+		return 3;
 	}
-	*/
+	applyConfig();
 
-	while (!pwm_closing) {
-		if (pwm_data_mutex.try_lock()){
-			local_pwm_data = pwm_data;
-			pwm_data_mutex.unlock();
-		}
-		if (local_pwm_data.size() < pwm_res) {	// Avoid segfaults when pwm data not initialized yet
-			std::this_thread::sleep_for(100ms);
-			continue;
+	const uint64_t period = static_cast<uint64_t>(1000000/cfg.refresh_rate);
+	Samples samples;
+	float userCache = 0;
+	bool seeded = false;
+	Record r;
+	bool more = player.next(r);
+
+	for (uint64_t t = 0; ; t += period) {		// [us]
+		// Records up to this refresh take effect in it
+		while (more && r.t * 1000 <= t) {
+			switch (r.type) {
+			case Record::SAMPLE:
+				samples.cpu = r.cpu;
+				samples.ram = r.ram;
+				samples.temp = r.temp;
+				if (!seeded) seedFilters(samples);
+				seeded = true;
+				break;
+			case Record::IO:
+				samples.disk = r.disk;
+				samples.disk_iops = r.disk_iops;
+				samples.net_rx = r.net_rx;
+				samples.net_tx = r.net_tx;
+				break;
+			case Record::CPU_TIMES:
+				samples.iowait = r.iowait;
+				samples.irq = r.irq;
+				samples.steal = r.steal;
+				break;
+			case Record::PERF:
+				samples.ipc = r.ipc;
+				samples.mpki = r.mpki;
+				samples.faults = r.faults;
+				break;
+			case Record::USER:
+				userCache = r.user;
+				break;
+			case Record::LEVEL:
+				// No PWM thread here, retired params may go at once
+				governor.setLevel(r.level);
+				applyConfig();
+				for (auto p : pwm_params_retired) delete p;
+				pwm_params_retired.clear();
+				break;
+			}
+			more = player.next(r);
 		}
-		for (int i = 0; i < pwm_res; i++) {
-			next_step += pwm_periods[i];
-			// Catch up if this thread is running really late
-			// Happens if daemon launches before Pi updates real time clock
-			if (next_step < std::chrono::high_resolution_clock::now())
-				next_step = std::chrono::high_resolution_clock::now() + pwm_periods[i];
-			sendFrame16(local_pwm_data[(i+1)%pwm_res]);
-			std::this_thread::sleep_until(next_step);
-			commitFrame();
+
+		pwm_data_datatype frame = renderFrame(samples, userCache, period / 1e6);
+		std::printf("%.3f", t / 1e6);
+		for (int i = 0; i < pwm_params->pwm_res; i++) {
+			std::printf(" %0*llx", CHAIN_WIDTH / 4,
+				    static_cast<unsigned long long>(frame[i]));
 		}
+		std::printf("\n");
+		if (!more) break;
 	}
 
-	gpioDeinit();
-
+	player.close();
+	if (!player.err.empty()) {
+		std::cerr << "error: " << path << ": " << player.err << std::endl;
+		return 3;
+	}
+	if (player.truncated) {
+		std::cerr << "warning: " << path << " ends with a partial record, "
+		  "left out" << std::endl;
+	}
+	return 0;
 }
 
 // =================================== MAIN ====================================
 
 void signal_handle(const int s) {
 	// Handles a few POSIX signals, asking the process to die gracefully
-	
-	main_closing = 1;
+	// or to reload its config file
 
-	if (s){};	// Suppress warning about unused, mandatory parameter
+	if (s == SIGHUP) reload_pending = 1;
+	else main_closing = 1;
 }
 
 //  -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   
 
-int main(int argc, char*argv[]) {
+int service(Clock::time_point started) {
+	// Runs the daemon until main_closing is set.
+	// The config is loaded by then, and clk is the clock to run on.
 
-	signal (SIGINT, signal_handle);		// Catches SIGINT (ctrl+c)
-	signal (SIGTERM, signal_handle);	// Catches SIGTERM
+	watchConfig();
+	applyConfig();
 
-        parseArgs(argc,argv);
-	if (arg_cmd == "allon") {
-		gpioInit();
-		sendFrame16(-1);	// Dirty "all ones" hack
-		commitFrame();
-                       setLedState(true);
-		exit(0);                // test-mode, no gpioDeInit()
-	}
-	else if (arg_cmd == "alloff") {
-		gpioInit();
-		setLedState(true);
-		exit(0);                // test-mode, no gpioDeInit()
-	}
-	else if (arg_user != "") {            // expecting a float 0<=x<=1
-		if (openShrMem(O_RDWR)) {
-			exit(3);
-		}
-		writeShrMem(arg_user);
-		closeShrMem();
-		exit(0);
-	}
-	else if (!arg_service) {  // require explicit -s flag for service
-		std::cerr << "error: illegal invocation" << std::endl;
-		help(argv[0]);
-	}
-	if (arg_brightness != "") {      // expecting a float 0<=x<=1
-		float value = std::stof(arg_brightness);
-		for (int i=0; i<16; i++) {
-			led_pwm_multipliers[i] =
-				std::min(1.0f,led_pwm_multipliers[i]*value);
-		}
+	if (arg_record != "" &&
+	    !recorder.open(arg_record, clk->now())) {
+		exit(3);
 	}
 
-	// create shared memory for user-led
-	if (openShrMem(O_RDWR|O_CREAT|O_EXCL)) {
+	// create shared memory for user-led, or reclaim a stale one
+	if (openShrMem(O_RDWR|O_CREAT)) {
 		exit(3);
 	}
 
+	// The first frame is rendered from instantaneous readings
+	// (CPU load is load average on the first call) before the
+	// PWM thread is started, so it has something to show right away.
+	// I/O rates and performance counters start at zero, as there is
+	// nothing to compare against.
+	float userCache = 0;
+	Samples samples;
+	cpufreq.open();
+	openIoSources();
+	openSampler();
+	openFan();
+	openPerf();
+	openPsi();
+	sampleFiles(samples);
+	seedFilters(samples);
+	paceSampling(samples);
+	updateFan(samples, clk->now());
+	recorder.sample(clk->now(), samples.cpu, samples.ram, samples.temp);
+	recorder.cpuTimes(clk->now(), samples.iowait, samples.irq, samples.steal);
+	publishFrame(renderFrame(samples, userCache, 0), pwm_params, softwareFan());
+
 	// An exact time to gather measurement data and update pwm values
 	// refresh_rate determines its frequency.
-	auto next_refresh = std::chrono::high_resolution_clock::now();
+	auto next_refresh = clk->now();
+	auto refresh_period = std::chrono::microseconds(
+			static_cast<uint32_t>(1000000/cfg.refresh_rate));
 	
 	// Create PWM thread
+	clk->expect();
 	std::thread pwm_thread (PWM);
 
-	// Assign Real Time priority to PWM thread
+	// Assign Real Time priority to PWM thread,
+	// which a simulated one does not need
 	sched_param sch;
 	int policy;
 	pthread_getschedparam(pwm_thread.native_handle(), &policy, &sch);
 	sch.sched_priority = 99;
-	pthread_setschedparam(pwm_thread.native_handle(), SCHED_FIFO, &sch);
-
+	int sched_err = clk->simulated() ? 0 :
+		pthread_setschedparam(pwm_thread.native_handle(), SCHED_FIFO, &sch);
+	if (sched_err) {
+		std::cerr << "No real time priority for PWM thread (" <<
+		  strerror(sched_err) << "), LEDs may fall back to static" << std::endl;
+	}
 
-	float userCache = 0;
-	float cpuCache = 0;
-	float ramCache = 0;
-	float tempCache = 0;
+	// The service is ready once the first frame is on the LEDs
+	while (!pwm_first_frame) clk->sleepFor(1ms);
+	auto first_frame = Clock::time_point(Clock::duration(pwm_first_frame.load()));
+	std::cerr << "First frame after " << std::chrono::duration<float,
+	  std::milli>(first_frame - started).count() << "ms" << std::endl;
+	sdNotify("READY=1");
+
+	// Watchdog keepalives are sent twice per period required by systemd,
+	// as long as both threads keep going
+	auto watchdog_period = sdWatchdog() / 2;
+	auto next_watchdog = clk->now();
+	uint64_t watchdogCycles = 0;
+
+	// Self-overhead accounting, needs to know the PWM thread first
+	self_monitor.open(pwm_thread.native_handle(), pwm_tid, stats_path);
+	auto next_stats = clk->now() + 1s;
+	auto next_summary = clk->now();
+
+	float recordedUser = 0;
 	int divCounter = 0;
+	auto last_refresh = clk->now();
+
+	// Events calling for the full sampling rate get a sample
+	// on the next refresh cycle
+	auto wake = [&]() {
+		pacer.wake(run_cfg.ref_div);
+		divCounter = std::max(divCounter, pacer.div() - 1);
+	};
+	uint64_t lastSlots = 0;
+	uint64_t lastLateSlots = 0;
+	int lastMode = MODE_PWM;
 
 	while (!main_closing) {
 
-		if (++divCounter >= ref_div) {
-			cpuCache = fetchCpu();
-			ramCache = fetchRam();
-                        if (tempCache >= 0.0) {
-                          // returns -1 if thermal_zone0 is missing
-                          tempCache = fetchTemp();
-                        }
+		if (configChanged() || reload_pending) {
+			reload_pending = 0;
+			std::string err;
+			if (loadConfig(config_path, base_cfg, cfg, err)) {
+				applyConfig();
+				openIoSources();
+				openSampler();
+				openFan();
+				openPerf();
+				openPsi();
+				refresh_period = std::chrono::microseconds(
+					static_cast<uint32_t>(1000000/cfg.refresh_rate));
+				std::cerr << "Reloaded " << config_path << std::endl;
+			} else {
+				std::cerr << "Config not reloaded: " << err << std::endl;
+			}
+		}
+		freeRetiredParams();
+
+		if (psi.fired()) wake();
+		if (++divCounter >= pacer.div()) {
+			sampleFiles(samples);
+			sampleIo(samples, clk->now());
+			samplePerf(samples, clk->now());
 			divCounter = 0;
+			recorder.sample(clk->now(), samples.cpu, samples.ram, samples.temp);
+			recorder.cpuTimes(clk->now(), samples.iowait, samples.irq,
+					  samples.steal);
+
+			// Share of PWM slots started late since the last sample
+			uint64_t slots = pwm_slots.load() - lastSlots;
+			uint64_t late = pwm_late_slots.load() - lastLateSlots;
+			lastSlots += slots;
+			lastLateSlots += late;
+			float lateRatio = slots ? 100.0f * late / slots : 0;
+
+			if (governor.update(cfg, cpu.f(), temp.f(), lateRatio,
+					    clk->now())) {
+				applyConfig();
+				recorder.level(clk->now(), governor.level());
+				std::cerr << "Governor level " << governor.level() <<
+				  ": pwm_res " << run_cfg.pwm_res <<
+				  ", pwm_lsb_period " << run_cfg.pwm_lsb_period <<
+				  "us, ref_div " << run_cfg.ref_div << std::endl;
+			}
+			paceSampling(samples);
 		}	
+		// Fan control runs every cycle, on the filtered temperature,
+		// so a kick ends on time however slowly sampling goes
+		updateFan(samples, clk->now());
+
+		// PWM supervisor decisions are logged here, not in the PWM thread
+		int mode = pwm_mode.load();
+		if (mode != lastMode) {
+			if (mode == MODE_STATIC) {
+				std::cerr << "PWM deadlines missed (" << pwm_miss_ratio.load() <<
+				  "% late slots), falling back to static LEDs" << std::endl;
+			} else {
+				std::cerr << "Probing PWM again" << std::endl;
+			}
+			lastMode = mode;
+		}
+		if (pwm_fan == -1 && fan_soft) {
+			std::cerr << "Unable to drive the fan pin, fan stays off" << std::endl;
+			fan_soft = false;
+		}
+
 		// Refresh user LED on every cycle, for faster response
 		userCache = fetchUser();
+		if (userCache != recordedUser) {
+			recorder.user(clk->now(), userCache);
+			recordedUser = userCache;
+			wake();
+		}
+		recorder.flush();
+
+		//  -   -   -   -   -   -   -   -   -   -   -   -   -   -   -
 
-		user = userCache;
-		cpu = cpuCache;
-		ram = ramCache;
-		temp = tempCache < 0.0 ? 0.0:tempCache;
+		auto now = clk->now();
+		float dt = std::chrono::duration<float>(now - last_refresh).count();
+		last_refresh = now;
+		publishFrame(renderFrame(samples, userCache, dt), pwm_params, softwareFan());
 
 		//  -   -   -   -   -   -   -   -   -   -   -   -   -   -   -
-	
-		pwm_data_mutex.lock();
-		pwm_data = format_pwms(led_pwms());
-		pwm_data_mutex.unlock();
+
+		now = clk->now();
+		if (watchdog_period.count() > 0 && now >= next_watchdog) {
+			next_watchdog = now + watchdog_period;
+			uint64_t cycles = pwm_cycles.load();
+			if (cycles != watchdogCycles) sdNotify("WATCHDOG=1");
+			watchdogCycles = cycles;
+		}
+		if (now >= next_stats) {
+			next_stats = now + 1s;
+			PwmHealth health = {pwm_mode.load(), pwm_miss_ratio.load(),
+					    pwm_fallbacks.load(), pwm_probes.load()};
+			bool fan_driven = fan_soft || fan_channel.isOpen();
+			self_monitor.update(pwm_slots.load(), pwm_late_slots.load(),
+					    pwm_shifts.load(), pwm_shifts_avoided.load(),
+					    governor.level(), cpuCapacity, throttledFlags,
+					    fan_driven ? fan.duty() : -1, fan.starts(),
+					    pacer.samples(), health);
+			auto interval = std::chrono::duration<float>(cfg.stats_interval);
+			if (cfg.stats_interval <= 0) {
+				next_summary = now;
+			} else if (now - next_summary >= interval) {
+				next_summary = now;
+				double usage;
+				std::cerr << self_monitor.summary(usage) << std::endl;
+				if (cfg.cpu_budget > 0 && usage > cfg.cpu_budget) {
+					std::cerr << "Warning: CPU usage " << usage <<
+					  "% exceeds budget of " << cfg.cpu_budget <<
+					  "%" << std::endl;
+				}
+			}
+		}
 
 		//  -   -   -   -   -   -   -   -   -   -   -   -   -   -   -
 
 		next_refresh += refresh_period;
 		// Catch up if this thread is running really late
 		// Happens if daemon launches before Pi updates real time clock
-		if (next_refresh < std::chrono::high_resolution_clock::now())
-			next_refresh = std::chrono::high_resolution_clock::now() + refresh_period;
-		std::this_thread::sleep_until(next_refresh);	
+		if (next_refresh < clk->now())
+			next_refresh = clk->now() + refresh_period;
+		clk->sleepUntil(next_refresh);
 	}
 
+	sdNotify("STOPPING=1");
 	pwm_closing = 1;
+	clk->leave();		// A simulated clock goes on with PWM thread alone
 	pwm_thread.join();
 	closeShrMem(true);
-	exit(0);
+	self_monitor.close();
+	recorder.close();
+	sampler.close();
+	psi.close();
+	perf.close();
+	fan_channel.close();
+	cpufreq.close();
+	diskstats.close();
+	netdev.close();
+	if (config_watch != -1) close(config_watch);
+	return 0;
 }
 
+//  -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   
+
+#ifndef SIM_HARNESS
+int main(int argc, char*argv[]) {
+
+	auto started = clk->now();
+
+	signal (SIGINT, signal_handle);		// Catches SIGINT (ctrl+c)
+	signal (SIGTERM, signal_handle);	// Catches SIGTERM
+	signal (SIGHUP, signal_handle);		// Catches SIGHUP (config reload)
+
+        parseArgs(argc,argv);
+	if (arg_cmd == "allon") {
+		gpioInit();
+		sendFrame<CHAIN_WIDTH>(~0ull);
+		commitFrame();
+                       setLedState(true);
+		exit(0);                // test-mode, no gpioDeInit()
+	}
+	else if (arg_cmd == "alloff") {
+		gpioInit();
+		setLedState(true);
+		exit(0);                // test-mode, no gpioDeInit()
+	}
+	else if (arg_cmd == "stats") {
+		exit(printStats() ? 0 : 3);
+	}
+	else if (arg_user != "") {            // expecting a float 0<=x<=1
+		if (openShrMem(O_RDWR)) {
+			exit(3);
+		}
+		writeShrMem(arg_user);
+		closeShrMem();
+		exit(0);
+	}
+	else if (!arg_service && arg_cmd != "replay") {  // require explicit -s flag for service
+		std::cerr << "error: illegal invocation" << std::endl;
+		help(argv[0]);
+	}
+	if (arg_brightness != "") {      // expecting a float 0<=x<=1
+		// The config file, if it sets brightness, takes precedence
+		base_cfg.brightness = std::min(1.0f, std::max(0.0f,
+					       std::stof(arg_brightness)));
+	}
+	cfg = base_cfg;
+
+	// The default config file is optional, an explicit one is not
+	if (arg_config != "") config_path = arg_config;
+	if (arg_config != "" || access(config_path.c_str(), F_OK) == 0) {
+		std::string err;
+		if (!loadConfig(config_path, base_cfg, cfg, err)) {
+			std::cerr << "error: " << err << std::endl;
+			exit(3);
+		}
+	}
+	if (arg_cmd == "replay") {
+		if (arg_file == "") help(argv[0]);
+		exit(replay(arg_file));
+	}
+	fs_root = arg_root;
+	exit(service(started));
+}
+#endif
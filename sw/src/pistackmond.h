@@ -0,0 +1,49 @@
+// -------------------------------------------------------------------------
+// Main application pistackmond
+//
+// pistackmond.h: the service loop, for the simulation harness (sim.cpp)
+// to run in place of main()
+//
+// Website: https://github.com/tomek-szczesny/pistackmon
+// Authors: Tomek Szczesny, Bernhard Bablok
+// License: GPL3
+// -------------------------------------------------------------------------
+
+#ifndef _PISTACKMOND_H
+#define _PISTACKMOND_H
+
+#include <string>
+
+#include "clock.h"
+#include "config.h"
+#include "fan.h"
+#include "pacer.h"
+#include "sampler.h"
+
+// Configuration loaded from config_path, watched for changes, on top of
+// base_cfg (defaults with command line options applied)
+extern Config cfg;
+extern Config base_cfg;
+extern std::string config_path;
+
+// Shared memory regions of the user LED and of self stats
+extern std::string shr_mem_path;
+extern std::string stats_path;
+
+// Files read on every sample
+extern Sampler sampler;
+
+// Fan control
+extern FanController fan;
+
+// Sampling rate
+extern Pacer pacer;
+
+// Signals the main thread to stop
+extern bool main_closing;
+
+// Runs the daemon until main_closing is set, on clk.
+// started is when the process has started, for startup time reporting.
+int service(Clock::time_point started);
+
+#endif
@@ -0,0 +1,262 @@
+// -------------------------------------------------------------------------
+// PWM thread
+//
+// pwm.cpp: binary code modulation of LED driver outputs
+//
+// Website: https://github.com/tomek-szczesny/pistackmon
+// Authors: Tomek Szczesny, Bernhard Bablok
+// License: GPL3
+// -------------------------------------------------------------------------
+
+#include <chrono>
+#include <thread>
+
+#include <unistd.h>		// syscall()
+#include <sys/syscall.h>	// SYS_gettid
+
+#include "clock.h"
+#include "pwm.h"
+#include "driver.h"
+
+using namespace std::chrono_literals;
+
+// Brightness gates shorter than this are timed by spinning, not sleeping
+const std::chrono::microseconds gate_spin(30);
+
+// In static mode new frames are picked up this often
+const std::chrono::milliseconds static_period(10);
+
+pwm_data_datatype pwm_data;
+pwm_schedule_datatype pwm_schedule;
+std::mutex pwm_data_mutex;
+
+std::atomic<const PwmParams *> pwm_params_next(nullptr);
+std::atomic<const PwmParams *> pwm_params_used(nullptr);
+
+std::atomic<uint64_t> pwm_slots(0);
+std::atomic<uint64_t> pwm_late_slots(0);
+
+std::atomic<uint64_t> pwm_shifts(0);
+std::atomic<uint64_t> pwm_shifts_avoided(0);
+
+std::atomic<uint64_t> pwm_cycles(0);
+
+std::atomic<int> pwm_mode(MODE_PWM);
+std::atomic<float> pwm_miss_ratio(0);
+std::atomic<uint64_t> pwm_fallbacks(0);
+std::atomic<uint64_t> pwm_probes(0);
+
+std::atomic<int> pwm_fan(0);
+std::atomic<int> pwm_tid(0);
+std::atomic<int64_t> pwm_first_frame(0);
+
+bool pwm_closing = 0;
+
+//  -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -
+
+static inline void waitUntil(Clock::time_point t) {
+	// Sleeps until a given time point, or spins if it is too close
+	// for a thread to wake up accurately
+
+	if (t - clk->now() > gate_spin) {
+		clk->sleepUntil(t);
+	} else {
+		clk->spinUntil(t);
+	}
+}
+
+//  -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -
+
+static uint64_t staticFrame(const PwmParams &p, const pwm_data_datatype &planes) {
+	// Reassembles each LED duty from bitplanes, and lights the LEDs
+	// at or above their thresholds
+
+	uint64_t frame = 0;
+	for (int j = 0; j < CHAIN_WIDTH; j++) {
+		uint32_t duty = 0;
+		for (int i = 0; i < p.pwm_res; i++) {
+			duty |= static_cast<uint32_t>(planes[i] >> j & 1) << i;
+		}
+		if (duty >= p.static_threshold[j]) frame |= 1ull << j;
+	}
+	return frame;
+}
+
+//  -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -
+
+void publishFrame(const pwm_data_datatype &frame, const PwmParams *p,
+		  float fan) {
+	pwm_schedule_datatype schedule = compactSchedule(*p, frame, fan);
+
+	pwm_data_mutex.lock();
+	pwm_data = frame;
+	pwm_schedule = schedule;
+	pwm_params_next.store(p);
+	pwm_data_mutex.unlock();
+}
+
+//  -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -
+
+void PWM() {
+	// This is a process intended to run as a separate thread
+	// for the sake of simplicity. Really.
+	// It reads pwm_data and executes whatever is in there.
+	// In order to kill this thread gracefully, set "pwm_closing" to 1. 
+
+	clk->enter();
+	auto next_step = clk->now();
+	pwm_data_datatype local_pwm_data;
+	pwm_schedule_datatype local_schedule;
+	const PwmParams *p = nullptr;
+	bool gated = false;
+	bool first = true;
+	PwmSupervisor supervisor;
+	pwm_data_datatype static_planes;
+	bool static_valid = false;		// static_planes are on the LEDs
+	// What the driver chain holds, so unchanged data is not sent again
+	uint64_t shifted = 0;
+	uint64_t latched = 0;
+	// Fan pin, set up once the fan is first driven
+	bool fan_ready = false;
+	bool fan_on = false;
+
+	pwm_tid = syscall(SYS_gettid);
+
+	gpioInit();		// Leaves the chain cleared
+	setLedState(true);
+	
+	/*
+	// Initial LED test
+	for (int i = 0; i < CHAIN_WIDTH; i++) {
+		sendFrame<CHAIN_WIDTH>(1ull << i);
+		commitFrame();
+		std::this_thread::sleep_for(150ms);	
+	}
+	*/
+
+	while (!pwm_closing) {
+		// Frames and the params they were rendered with are
+		// picked up together, only here at the cycle boundary
+		if (pwm_data_mutex.try_lock()){
+			local_pwm_data = pwm_data;
+			local_schedule = pwm_schedule;
+			p = pwm_params_next.load();
+			pwm_data_mutex.unlock();
+			pwm_params_used.store(p);
+		}
+		if (!p) {	// pwm data not initialized yet
+			clk->sleepFor(1ms);
+			continue;
+		}
+		if (local_schedule.fan_used && pwm_fan == 0) {
+			fan_ready = fanInit();
+			pwm_fan = fan_ready ? 1 : -1;
+		}
+		if (supervisor.mode() == MODE_STATIC) {
+			// Frames are latched only when they change, brightness
+			// is all or nothing
+			if (!static_valid || local_pwm_data != static_planes) {
+				shifted = latched = staticFrame(*p, local_pwm_data);
+				sendFrame<CHAIN_WIDTH>(latched);
+				commitFrame();
+				static_planes = local_pwm_data;
+				static_valid = true;
+			}
+			setLedState(p->pwm_on_times.back().count() > 0);
+			// The fan runs at full speed rather than not at all
+			bool fan = local_schedule.fan_used && local_schedule.fan;
+			if (fan_ready && fan != fan_on) {
+				setFan(fan);
+				fan_on = fan;
+			}
+			gated = true;
+			pwm_cycles.fetch_add(1, std::memory_order_relaxed);
+			clk->sleepFor(static_period);
+			if (supervisor.update(p->fallback, 0, 0, clk->now())) {
+				static_valid = false;
+				next_step = clk->now();
+				pwm_mode = supervisor.mode();
+				pwm_probes = supervisor.probes();
+			}
+			continue;
+		}
+		// Gating may have left LEDs blanked
+		if (gated && !p->gated) setLedState(true);
+		gated = p->gated;
+		const pwm_schedule_datatype &sch = local_schedule;
+		int late = 0;
+		int shifts = 0;
+		for (int i = 0; i < sch.slots; i++) {
+			next_step += sch.periods[i];
+			// Catch up if this thread is running really late
+			// Happens if daemon launches before Pi updates real time clock
+			// Such a slot has missed its deadline too.
+			bool missed = false;
+			if (next_step < clk->now()) {
+				next_step = clk->now() + sch.periods[i];
+				missed = true;
+			}
+			// The plane of the next slot, the last slot leading into
+			// the first one of the next cycle. It is not sent again
+			// if the chain holds it already, and not latched either
+			// if it is on the outputs, as happens with a single slot.
+			const uint64_t next = sch.planes[(i+1)%sch.slots];
+			const bool send = next != shifted;
+			const bool latch = next != latched || first;
+			if (gated) {
+				// Blanks LEDs once the on time of this slot is over.
+				// The next frame is sent in whichever part of the slot
+				// is longer, so it does not delay the gate.
+				auto slot_start = next_step - sch.periods[i];
+				auto gate = slot_start + sch.on_times[i];
+				bool send_first = sch.on_times[i] * 2 > sch.periods[i];
+				if (send && send_first) sendFrame<CHAIN_WIDTH>(next);
+				waitUntil(gate);
+				setLedState(false);
+				if (send && !send_first) sendFrame<CHAIN_WIDTH>(next);
+			} else if (send) {
+				sendFrame<CHAIN_WIDTH>(next);
+			}
+			if (send) {
+				shifted = next;
+				shifts++;
+			}
+			clk->sleepUntil(next_step);
+			if (latch) {
+				commitFrame();
+				latched = next;
+			}
+			const bool fan = sch.fan_used && (sch.fan >> (i+1)%sch.slots & 1);
+			if (fan_ready && fan != fan_on) {
+				setFan(fan);
+				fan_on = fan;
+			}
+			if (first) {
+				pwm_first_frame = clk->now()
+						  .time_since_epoch().count();
+				first = false;
+			}
+			if (gated && sch.on_times[(i+1)%sch.slots].count() > 0)
+				setLedState(true);
+			// A slot started more than one LSB late
+			if (clk->now() - next_step > p->pwm_periods[0])
+				missed = true;
+			if (missed) late++;
+		}
+		pwm_slots.fetch_add(sch.slots, std::memory_order_relaxed);
+		pwm_late_slots.fetch_add(late, std::memory_order_relaxed);
+		pwm_shifts.fetch_add(shifts, std::memory_order_relaxed);
+		pwm_shifts_avoided.fetch_add(p->pwm_res - shifts, std::memory_order_relaxed);
+		pwm_cycles.fetch_add(1, std::memory_order_relaxed);
+
+		if (supervisor.update(p->fallback, sch.slots, late, clk->now())) {
+			pwm_mode = supervisor.mode();
+			pwm_fallbacks = supervisor.fallbacks();
+		}
+		pwm_miss_ratio.store(supervisor.missRatio(), std::memory_order_relaxed);
+	}
+
+	if (fan_ready) fanDeinit();
+	gpioDeinit();
+	clk->leave();
+}
@@ -0,0 +1,79 @@
+// -------------------------------------------------------------------------
+// PWM thread
+//
+// pwm.h: binary code modulation of LED driver outputs, and the state
+// shared with the thread rendering frames for it
+//
+// Website: https://github.com/tomek-szczesny/pistackmon
+// Authors: Tomek Szczesny, Bernhard Bablok
+// License: GPL3
+// -------------------------------------------------------------------------
+
+#ifndef _PWM_H
+#define _PWM_H
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+
+#include "render.h"
+
+// pwm_data contains data for PWM() thread to work on, pwm_schedule is
+// the same frame with identical adjacent bitplanes merged
+// pwm_data_mutex protects both
+extern pwm_data_datatype pwm_data;
+extern pwm_schedule_datatype pwm_schedule;
+extern std::mutex pwm_data_mutex;
+
+// pwm_params_next is published by the rendering thread (under
+// pwm_data_mutex), pwm_params_used is the set the PWM thread has last
+// picked up. Params may be freed only once no longer in use.
+extern std::atomic<const PwmParams *> pwm_params_next;
+extern std::atomic<const PwmParams *> pwm_params_used;
+
+// PWM timing statistics, updated by the PWM thread once per cycle
+extern std::atomic<uint64_t> pwm_slots;
+extern std::atomic<uint64_t> pwm_late_slots;
+
+// Frames shifted into the LED driver chain, and shifts saved by merged
+// and unchanged bitplanes, against one for every bitplane of every cycle
+extern std::atomic<uint64_t> pwm_shifts;
+extern std::atomic<uint64_t> pwm_shifts_avoided;
+
+// Cycles done, PWM or static alike, so the thread is known to be alive
+extern std::atomic<uint64_t> pwm_cycles;
+
+// Supervisor state, updated by the PWM thread (see supervisor.h):
+// current PwmMode, share of late slots over its window [%],
+// switches to static mode and probes back to PWM
+extern std::atomic<int> pwm_mode;
+extern std::atomic<float> pwm_miss_ratio;
+extern std::atomic<uint64_t> pwm_fallbacks;
+extern std::atomic<uint64_t> pwm_probes;
+
+// Fan pin state, set by the PWM thread: 1 - driven, 0 - not (yet),
+// -1 - no fan pin could be set up
+extern std::atomic<int> pwm_fan;
+
+// Kernel thread ID of PWM thread, for self-overhead accounting
+extern std::atomic<int> pwm_tid;
+
+// When the first frame has been latched, in steady_clock ticks since its
+// epoch. 0 until then.
+extern std::atomic<int64_t> pwm_first_frame;
+
+// Signals the PWM thread to stop
+extern bool pwm_closing;
+
+// Hands a frame over to the PWM thread, along with the params it was
+// rendered with. Its PWM slots are worked out here, off the PWM thread.
+// fan - duty of the fan to drive with software PWM (0-1), -1 if none
+void publishFrame(const pwm_data_datatype &frame, const PwmParams *p,
+		  float fan = -1);
+
+// This is a process intended to run as a separate thread.
+// It initializes GPIO, executes whatever is in pwm_data until pwm_closing
+// is set, then turns LEDs off.
+void PWM();
+
+#endif
@@ -0,0 +1,316 @@
+// -------------------------------------------------------------------------
+// Metric recording
+//
+// record.cpp: compact recordings of measurements
+//
+// Website: https://github.com/tomek-szczesny/pistackmon
+// Authors: Tomek Szczesny, Bernhard Bablok
+// License: GPL3
+// -------------------------------------------------------------------------
+
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <ctime>
+
+#include "record.h"
+
+// Fixed point scales of recorded values
+#define SCALE_PERCENT 100	// 0.01%
+#define SCALE_TEMP    1000	// 0.001C, as in sysfs
+#define SCALE_USER    65535
+#define SCALE_IOPS    100	// 0.01/s, rates in bytes/s are whole
+#define SCALE_IPC     1000
+#define SCALE_MPKI    100
+
+//=================================== MISC =====================================
+
+static inline uint64_t zigzag(int64_t v) {
+	// Maps signed numbers to unsigned ones, small magnitudes staying small
+	return (static_cast<uint64_t>(v) << 1) ^ static_cast<uint64_t>(v >> 63);
+}
+
+static inline int64_t unzigzag(uint64_t v) {
+	return static_cast<int64_t>(v >> 1) ^ -static_cast<int64_t>(v & 1);
+}
+
+static inline int64_t fixed(float v, int scale) {
+	return static_cast<int64_t>(std::lround(v * scale));
+}
+
+//================================ Recorder ====================================
+
+bool Recorder::open(const std::string &path,
+		    std::chrono::steady_clock::time_point now) {
+	f = std::fopen(path.c_str(), "wbe");
+	if (!f) {
+		perror("Unable to create recording");
+		return false;
+	}
+	start = now;
+	last_t = 0;
+	last_cpu = last_ram = last_temp = last_user = 0;
+	for (auto &v : last_io) v = 0;
+	for (auto &v : last_perf) v = 0;
+	for (auto &v : last_times) v = 0;
+
+	uint64_t wall = static_cast<uint64_t>(std::time(nullptr));
+	uint8_t hdr[13];
+	std::memcpy(hdr, RECORD_MAGIC, 4);
+	hdr[4] = RECORD_VERSION;
+	for (int i = 0; i < 8; i++) hdr[5 + i] = static_cast<uint8_t>(wall >> (8 * i));
+	std::fwrite(hdr, 1, sizeof(hdr), f);
+	return true;
+}
+
+//  -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -
+
+void Recorder::put(uint64_t v) {
+	// Writes a LEB128 varint
+	while (v >= 0x80) {
+		std::putc(static_cast<int>((v & 0x7F) | 0x80), f);
+		v >>= 7;
+	}
+	std::putc(static_cast<int>(v), f);
+}
+
+//  -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -
+
+void Recorder::header(Record::Type type,
+		      std::chrono::steady_clock::time_point now) {
+	// Writes type and time of a record
+
+	uint64_t t = std::chrono::duration_cast<std::chrono::milliseconds>(
+			now - start).count();
+	if (t < last_t) t = last_t;
+	std::putc(type, f);
+	put(t - last_t);
+	last_t = t;
+}
+
+//  -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -
+
+void Recorder::sample(std::chrono::steady_clock::time_point now,
+		      float cpu, float ram, float temp) {
+	if (!f) return;
+	int64_t c = fixed(cpu, SCALE_PERCENT);
+	int64_t r = fixed(ram, SCALE_PERCENT);
+	int64_t t = fixed(temp, SCALE_TEMP);
+	header(Record::SAMPLE, now);
+	put(zigzag(c - last_cpu));
+	put(zigzag(r - last_ram));
+	put(zigzag(t - last_temp));
+	last_cpu = c;
+	last_ram = r;
+	last_temp = t;
+}
+
+//  -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -
+
+void Recorder::user(std::chrono::steady_clock::time_point now, float user) {
+	if (!f) return;
+	int64_t u = fixed(user, SCALE_USER);
+	header(Record::USER, now);
+	put(zigzag(u - last_user));
+	last_user = u;
+}
+
+//  -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -
+
+void Recorder::level(std::chrono::steady_clock::time_point now, int level) {
+	if (!f) return;
+	header(Record::LEVEL, now);
+	put(static_cast<uint64_t>(level));
+}
+
+//  -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -
+
+void Recorder::io(std::chrono::steady_clock::time_point now,
+		  float disk, float disk_iops, float net_rx, float net_tx) {
+	if (!f) return;
+	const int64_t v[4] = {fixed(disk, 1), fixed(disk_iops, SCALE_IOPS),
+			      fixed(net_rx, 1), fixed(net_tx, 1)};
+	header(Record::IO, now);
+	for (int i = 0; i < 4; i++) {
+		put(zigzag(v[i] - last_io[i]));
+		last_io[i] = v[i];
+	}
+}
+
+//  -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -
+
+void Recorder::perf(std::chrono::steady_clock::time_point now,
+		    float ipc, float mpki, float faults) {
+	if (!f) return;
+	const int64_t v[3] = {fixed(ipc, SCALE_IPC), fixed(mpki, SCALE_MPKI),
+			      fixed(faults, 1)};
+	header(Record::PERF, now);
+	for (int i = 0; i < 3; i++) {
+		put(zigzag(v[i] - last_perf[i]));
+		last_perf[i] = v[i];
+	}
+}
+
+//  -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -
+
+void Recorder::cpuTimes(std::chrono::steady_clock::time_point now,
+			float iowait, float irq, float steal) {
+	// Mostly zero, so only changes are written
+
+	if (!f) return;
+	const int64_t v[3] = {fixed(iowait, SCALE_PERCENT), fixed(irq, SCALE_PERCENT),
+			      fixed(steal, SCALE_PERCENT)};
+	if (v[0] == last_times[0] && v[1] == last_times[1] && v[2] == last_times[2])
+		return;
+	header(Record::CPU_TIMES, now);
+	for (int i = 0; i < 3; i++) {
+		put(zigzag(v[i] - last_times[i]));
+		last_times[i] = v[i];
+	}
+}
+
+//  -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -
+
+void Recorder::flush() {
+	// Nothing is written if nothing has been recorded since
+	if (f) std::fflush(f);
+}
+
+//  -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -
+
+void Recorder::close() {
+	if (!f) return;
+	std::fclose(f);
+	f = nullptr;
+}
+
+//================================== Player ====================================
+
+bool Player::open(const std::string &path) {
+	f = std::fopen(path.c_str(), "rbe");
+	if (!f) {
+		err = "Unable to open " + path + ": " + std::strerror(errno);
+		return false;
+	}
+	uint8_t hdr[13];
+	if (std::fread(hdr, 1, sizeof(hdr), f) != sizeof(hdr) ||
+	    std::memcmp(hdr, RECORD_MAGIC, 4) != 0) {
+		err = path + " is not a pistackmond recording";
+		close();
+		return false;
+	}
+	if (hdr[4] < 1 || hdr[4] > RECORD_VERSION) {
+		err = path + ": unsupported recording version " +
+		      std::to_string(hdr[4]);
+		close();
+		return false;
+	}
+	uint64_t wall = 0;
+	for (int i = 0; i < 8; i++) wall |= static_cast<uint64_t>(hdr[5 + i]) << (8 * i);
+	started = static_cast<int64_t>(wall);
+	t = 0;
+	truncated = false;
+	cpu = ram = temp = user = 0;
+	for (auto &v : io) v = 0;
+	for (auto &v : perf) v = 0;
+	for (auto &v : times) v = 0;
+	return true;
+}
+
+//  -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -
+
+bool Player::get(uint64_t &v) {
+	// Reads a LEB128 varint
+	v = 0;
+	for (int shift = 0; shift < 64; shift += 7) {
+		int c = std::getc(f);
+		if (c == EOF) return false;
+		v |= static_cast<uint64_t>(c & 0x7F) << shift;
+		if (!(c & 0x80)) return true;
+	}
+	return false;
+}
+
+//  -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -
+
+bool Player::next(Record &r) {
+	if (!f) return false;
+	int type = std::getc(f);
+	if (type == EOF) return false;
+
+	uint64_t dt, a, b, c;
+	bool ok = get(dt);
+	t += dt;
+	r.t = t;
+	switch (type) {
+	case Record::SAMPLE:
+		ok = ok && get(a) && get(b) && get(c);
+		cpu += unzigzag(a);
+		ram += unzigzag(b);
+		temp += unzigzag(c);
+		r.type = Record::SAMPLE;
+		r.cpu = static_cast<float>(cpu) / SCALE_PERCENT;
+		r.ram = static_cast<float>(ram) / SCALE_PERCENT;
+		r.temp = static_cast<float>(temp) / SCALE_TEMP;
+		break;
+	case Record::USER:
+		ok = ok && get(a);
+		user += unzigzag(a);
+		r.type = Record::USER;
+		r.user = static_cast<float>(user) / SCALE_USER;
+		break;
+	case Record::LEVEL:
+		ok = ok && get(a);
+		r.type = Record::LEVEL;
+		r.level = static_cast<int>(a);
+		break;
+	case Record::IO:
+		for (int i = 0; i < 4; i++) {
+			ok = ok && get(a);
+			io[i] += unzigzag(a);
+		}
+		r.type = Record::IO;
+		r.disk = static_cast<float>(io[0]);
+		r.disk_iops = static_cast<float>(io[1]) / SCALE_IOPS;
+		r.net_rx = static_cast<float>(io[2]);
+		r.net_tx = static_cast<float>(io[3]);
+		break;
+	case Record::PERF:
+		for (int i = 0; i < 3; i++) {
+			ok = ok && get(a);
+			perf[i] += unzigzag(a);
+		}
+		r.type = Record::PERF;
+		r.ipc = static_cast<float>(perf[0]) / SCALE_IPC;
+		r.mpki = static_cast<float>(perf[1]) / SCALE_MPKI;
+		r.faults = static_cast<float>(perf[2]);
+		break;
+	case Record::CPU_TIMES:
+		for (int i = 0; i < 3; i++) {
+			ok = ok && get(a);
+			times[i] += unzigzag(a);
+		}
+		r.type = Record::CPU_TIMES;
+		r.iowait = static_cast<float>(times[0]) / SCALE_PERCENT;
+		r.irq = static_cast<float>(times[1]) / SCALE_PERCENT;
+		r.steal = static_cast<float>(times[2]) / SCALE_PERCENT;
+		break;
+	default:
+		err = "unknown record type " + std::to_string(type);
+		return false;
+	}
+	// A crash may leave the last record partly written
+	if (!ok) {
+		truncated = true;
+		return false;
+	}
+	return true;
+}
+
+//  -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -
+
+void Player::close() {
+	if (!f) return;
+	std::fclose(f);
+	f = nullptr;
+}
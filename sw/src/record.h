@@ -0,0 +1,138 @@
+// -------------------------------------------------------------------------
+// Metric recording
+//
+// record.h: compact recordings of measurements, for replaying them later
+// through the same rendering pipeline
+//
+// Website: https://github.com/tomek-szczesny/pistackmon
+// Authors: Tomek Szczesny, Bernhard Bablok
+// License: GPL3
+// -------------------------------------------------------------------------
+
+#ifndef _RECORD_H
+#define _RECORD_H
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+// File layout:
+//   "PSMR", version byte, start time (unix seconds, 8 bytes little endian)
+//   records: type byte, time since previous record [ms], payload
+// Numbers are LEB128 varints. Measurements are fixed point, stored as
+// zigzag-encoded differences from the previous value of the same kind,
+// so a typical sample takes less than 8 bytes.
+// The version goes up with every new record type, so older readers reject
+// a recording up front rather than at the first record they don't know.
+// Readers take any version up to their own.
+//   1 - SAMPLE, USER, LEVEL
+//   2 - IO
+//   3 - PERF
+//   4 - CPU_TIMES
+#define RECORD_MAGIC   "PSMR"
+#define RECORD_VERSION 4
+
+struct Record {
+	enum Type : uint8_t {
+		SAMPLE = 1,	// cpu, ram, temp as returned by fetch*()
+		USER = 2,	// user LED value has changed
+		LEVEL = 3,	// governor level has changed
+		IO = 4,		// disk and network rates
+		PERF = 5,	// performance counters
+		CPU_TIMES = 6	// iowait, irq and steal, when they change
+	} type;
+	uint64_t t;		// since the start of recording [ms]
+	float cpu;		// [%]
+	float ram;		// [%]
+	float temp;		// [C], -1 if not available
+	float user;		// [0-1]
+	int level;
+	float disk;		// [bytes/s]
+	float disk_iops;	// [1/s]
+	float net_rx;		// [bytes/s]
+	float net_tx;		// [bytes/s]
+	float ipc;		// -1 if not counted
+	float mpki;		// -1 if not counted
+	float faults;		// [1/s]
+	float iowait;		// [% of CPU time]
+	float irq;		// irq + softirq [% of CPU time]
+	float steal;		// [% of CPU time]
+};
+
+class Recorder {
+	// Appends records to a file. Writes are buffered until flush(),
+	// called once per refresh cycle, so recording costs no extra wakeups
+	// and a crash loses no more than the cycle it happens in.
+
+	private:
+	FILE *f = nullptr;
+	std::chrono::steady_clock::time_point start;
+	uint64_t last_t = 0;
+	int64_t last_cpu = 0, last_ram = 0, last_temp = 0, last_user = 0;
+	int64_t last_io[4] = {0, 0, 0, 0};
+	int64_t last_perf[3] = {0, 0, 0};
+	int64_t last_times[3] = {0, 0, 0};
+
+	void put(uint64_t v);
+	void header(Record::Type type, std::chrono::steady_clock::time_point now);
+
+	public:
+
+	// Creates the file, now being the start of recording.
+	// Returns false on failure.
+	bool open(const std::string &path, std::chrono::steady_clock::time_point now);
+
+	void sample(std::chrono::steady_clock::time_point now,
+		    float cpu, float ram, float temp);
+	void user(std::chrono::steady_clock::time_point now, float user);
+	void level(std::chrono::steady_clock::time_point now, int level);
+	void io(std::chrono::steady_clock::time_point now,
+		float disk, float disk_iops, float net_rx, float net_tx);
+	void perf(std::chrono::steady_clock::time_point now,
+		  float ipc, float mpki, float faults);
+	void cpuTimes(std::chrono::steady_clock::time_point now,
+		      float iowait, float irq, float steal);
+
+	// Writes out records made since the last call
+	void flush();
+
+	bool isOpen() const { return f != nullptr; }
+	void close();
+};
+
+class Player {
+	// Reads records back, in order
+
+	private:
+	FILE *f = nullptr;
+	uint64_t t = 0;
+	int64_t cpu = 0, ram = 0, temp = 0, user = 0;
+	int64_t io[4] = {0, 0, 0, 0};
+	int64_t perf[3] = {0, 0, 0};
+	int64_t times[3] = {0, 0, 0};
+
+	bool get(uint64_t &v);
+
+	public:
+
+	// Start time of the recording [unix seconds]
+	int64_t started = 0;
+
+	// Describes why open() or next() failed
+	std::string err;
+
+	// Set if the recording ends with a partial record
+	bool truncated = false;
+
+	// Opens a recording and checks its header. Returns false on failure.
+	bool open(const std::string &path);
+
+	// Returns false at the end of recording, err is set if it was
+	// corrupted. A partial last record ends it as well, setting truncated.
+	bool next(Record &r);
+
+	void close();
+};
+
+#endif
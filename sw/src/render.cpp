@@ -0,0 +1,244 @@
+// -------------------------------------------------------------------------
+// LED rendering
+//
+// render.cpp: conversion of measurements into PWM bitplanes
+//
+// Website: https://github.com/tomek-szczesny/pistackmon
+// Authors: Tomek Szczesny, Bernhard Bablok
+// License: GPL3
+// -------------------------------------------------------------------------
+
+#include <algorithm>
+#include <cmath>
+
+#include "render.h"
+
+// Layout vectors, containing positions of each LED in LED driver register
+const std::vector<int> cpu_layout = {4, 3, 2, 1, 0};
+const std::vector<int> ram_layout = {9, 8, 7, 6, 5};
+const std::vector<int> temp_layout = {11, 10, 12, 13, 14};
+const std::vector<int> user_layout = {15};
+
+static std::vector<std::vector<int>> barLayouts() {
+	// Stock bars, then extension bars filling up from their first output
+	std::vector<std::vector<int>> l = {cpu_layout, ram_layout, temp_layout};
+	for (int b = 0; b < EXT_BARS; b++) {
+		l.push_back({16 + 5*b, 17 + 5*b, 18 + 5*b, 19 + 5*b, 20 + 5*b});
+	}
+	return l;
+}
+
+const std::vector<std::vector<int>> bar_layouts = barLayouts();
+
+//============================== LED LINEARIZATION =============================
+
+static float led_linear(float in, float gamma) {
+	// A LED linearization algorithm that takes a brightness value (0-1)
+	// and returns duty cycle (also 0-1).
+	// This is not the actual "gamma" correction, but something similar.
+
+	float a = 1 / (std::exp(gamma) - 1);
+	return a * (std::exp(gamma*in) - 1);
+}
+
+//  -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -
+
+PwmParams *buildPwmParams(const Config &c) {
+	// Precomputes everything that depends on the config,
+	// so neither thread has to do that on every frame.
+
+	PwmParams *p = new PwmParams;
+	p->pwm_res = c.pwm_res;
+
+	// Every more significant bit gets twice the time of the previous one
+	for (int i = 0; i < c.pwm_res; i++) {
+		p->pwm_periods.push_back(std::chrono::microseconds(
+				static_cast<uint32_t>(c.pwm_lsb_period*std::pow(2,i))));
+		p->pwm_on_times.push_back(std::chrono::nanoseconds(
+				static_cast<int64_t>(c.brightness * 1000 *
+				p->pwm_periods[i].count())));
+	}
+	p->gated = c.brightness < 1;
+
+	// Colors of the stock board, further drivers of a chain use led_ext
+	const float mult[16] = {c.led_y, c.led_g, c.led_g, c.led_g, c.led_g,
+				c.led_r, c.led_y, c.led_g, c.led_g, c.led_g,
+				c.led_g, c.led_g, c.led_y, c.led_r, c.led_r, c.led_b};
+	const float full = std::pow(2, c.pwm_res) - 1;
+
+	for (int i = 0; i < CHAIN_WIDTH; i++) {
+		float m = i < 16 ? mult[i] : c.led_ext;
+		for (int j = 0; j <= LUT_STEPS; j++) {
+			float duty = led_linear(static_cast<float>(j) / LUT_STEPS,
+						c.led_gamma);
+			p->lut[i][j] = static_cast<uint16_t>(duty * m * full);
+		}
+		p->static_threshold[i] = std::max<uint16_t>(p->lut[i][LUT_STEPS / 2], 1);
+	}
+	p->split_dim = static_cast<int32_t>(c.cpu_split_dim * LEVEL_ONE);
+
+	p->fallback.enabled = c.fallback;
+	p->fallback.window = std::chrono::duration<float>(c.fallback_window);
+	p->fallback.miss_high = c.fallback_miss_high;
+	p->fallback.miss_low = c.fallback_miss_low;
+	p->fallback.probe_interval = std::chrono::duration<float>(c.fallback_probe_interval);
+	p->fallback.probe_time = std::chrono::duration<float>(c.fallback_probe_time);
+	return p;
+}
+
+// ================================ LED DRIVING ================================
+
+static inline int32_t toLevel(float value, float lo, float hi) {
+	// Maps value from lo..hi range to 0..LEVEL_ONE
+
+	float f = (value - lo) * (LEVEL_ONE / (hi - lo));
+	if (!(f > 0)) return 0;		// Catches NaNs too
+	if (f >= LEVEL_ONE) return LEVEL_ONE;
+	return static_cast<int32_t>(f);
+}
+
+//  -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -
+
+static inline uint16_t lutLookup(const uint16_t *lut, int32_t level) {
+	// Interpolates a duty cycle for a given LED level
+
+	if (level >= LEVEL_ONE) return lut[LUT_STEPS];
+	const int shift = LEVEL_BITS - LUT_BITS;
+	int32_t idx = level >> shift;
+	int32_t frac = level & ((1 << shift) - 1);
+	int32_t a = lut[idx];
+	int32_t b = lut[idx + 1];
+	return static_cast<uint16_t>(a + (((b - a) * frac) >> shift));
+}
+
+//  -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -
+
+static inline void renderBar(const PwmParams &p, const std::vector<int> &layout,
+			     int32_t level, led_duties_datatype &out,
+			     int32_t split = LEVEL_ONE) {
+	// Fills the bar LED by LED, level being the fill of the whole bar.
+	// The part of a LED above split (a level of the whole bar as well)
+	// is lit at split_dim.
+
+	int32_t size = static_cast<int32_t>(layout.size());
+	int32_t pos = level * size;
+	int32_t below = std::min(split, level) * size;
+	for (size_t i = 0; i < layout.size(); i++) {
+		int32_t l = std::min(std::max(pos, 0), LEVEL_ONE);
+		int32_t b = std::min(std::max(below, 0), l);
+		if (b < l) {
+			l = b + static_cast<int32_t>((static_cast<int64_t>(l - b) *
+						      p.split_dim) >> LEVEL_BITS);
+		}
+		out[layout[i]] = lutLookup(p.lut[layout[i]], l);
+		pos -= LEVEL_ONE;
+		below -= LEVEL_ONE;
+	}
+}
+
+//  -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -
+
+led_duties_datatype led_pwms(const PwmParams &p,
+			     const bar_fills_datatype &fills, float user,
+			     const bar_splits_datatype *splits) {
+	// converts bar fills into PWM duty cycles of each LED
+	// Includes LED PWM multipliers (for intensity correcton or whatever)
+	// Also includes gamma correction, both precomputed in lookup tables.
+
+	led_duties_datatype output;
+	output.fill(0);
+
+	for (int b = 0; b < BARS; b++) {
+		int32_t split = splits ? toLevel((*splits)[b], 0, 1) : LEVEL_ONE;
+		renderBar(p, bar_layouts[b], toLevel(fills[b], 0, 1), output, split);
+	}
+	renderBar(p, user_layout, toLevel(user, 0, 1), output);
+
+	return output;
+}
+
+//  -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -
+
+void transpose16(const uint16_t *duties, uint16_t *planes) {
+	// Converts duty cycles of 16 LEDs into bitplanes.
+	// This is a transposition of a 16x16 bit matrix, done by swapping
+	// ever smaller blocks of bits, many bits at a time.
+	// Bit j of plane i ends up being bit i of LED j duty.
+	//
+	// Rows are packed four to a 64-bit word (row 4w+l in lane l of w[w]),
+	// so 8 and 4 row swaps happen between words, and 2 and 1 row swaps
+	// between lanes of the same word.
+	// Bits shifted across lane boundaries always fall outside of the mask.
+
+	uint64_t w[4];
+	for (int i = 0; i < 4; i++) {
+		w[i] =  static_cast<uint64_t>(duties[4*i])         |
+			static_cast<uint64_t>(duties[4*i + 1]) << 16 |
+			static_cast<uint64_t>(duties[4*i + 2]) << 32 |
+			static_cast<uint64_t>(duties[4*i + 3]) << 48;
+	}
+
+	uint64_t t;
+	const uint64_t m8 = 0x00FF00FF00FF00FFull;
+	const uint64_t m4 = 0x0F0F0F0F0F0F0F0Full;
+	const uint64_t m2 = 0x0000000033333333ull;
+	const uint64_t m1 = 0x0000555500005555ull;
+
+	for (int i = 0; i < 2; i++) {			// rows k, k+8
+		t = ((w[i] >> 8) ^ w[i + 2]) & m8;
+		w[i + 2] ^= t;
+		w[i] ^= t << 8;
+	}
+	for (int i = 0; i < 4; i += 2) {		// rows k, k+4
+		t = ((w[i] >> 4) ^ w[i + 1]) & m4;
+		w[i + 1] ^= t;
+		w[i] ^= t << 4;
+	}
+	for (int i = 0; i < 4; i++) {			// rows k, k+2
+		t = ((w[i] >> 2) ^ (w[i] >> 32)) & m2;
+		w[i] ^= (t << 32) | (t << 2);
+	}
+	for (int i = 0; i < 4; i++) {			// rows k, k+1
+		t = ((w[i] >> 1) ^ (w[i] >> 16)) & m1;
+		w[i] ^= (t << 16) | (t << 1);
+	}
+
+	for (int i = 0; i < 16; i++) {
+		planes[i] = static_cast<uint16_t>(w[i / 4] >> (16 * (i % 4)));
+	}
+}
+
+//  -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -
+
+pwm_schedule_datatype compactSchedule(const PwmParams &p,
+				      const pwm_data_datatype &planes,
+				      float fan) {
+	// Saturated LEDs are common, and leave adjacent bitplanes identical,
+	// e.g. all of them with every LED either dark or fully lit.
+	// Merged slots keep the total time and on time of the bits they hold,
+	// so every LED keeps its duty cycle.
+	// Slot periods are binary weighted, so the fan duty quantized to
+	// pwm_res bits tells which slots the fan is on in.
+
+	const uint32_t fan_bits = fan < 0 ? 0 : static_cast<uint32_t>(std::lround(
+		std::min(fan, 1.0f) * ((1u << p.pwm_res) - 1)));
+	pwm_schedule_datatype s;
+	s.slots = 0;
+	s.fan_used = fan >= 0;
+	s.fan = 0;
+	for (int i = 0; i < p.pwm_res; i++) {
+		const bool fan_on = fan_bits >> i & 1;
+		if (s.slots > 0 && planes[i] == s.planes[s.slots - 1] &&
+		    fan_on == (s.fan >> (s.slots - 1) & 1)) {
+			s.periods[s.slots - 1] += p.pwm_periods[i];
+			s.on_times[s.slots - 1] += p.pwm_on_times[i];
+			continue;
+		}
+		s.planes[s.slots] = planes[i];
+		s.periods[s.slots] = p.pwm_periods[i];
+		s.on_times[s.slots] = p.pwm_on_times[i];
+		s.fan |= fan_on << s.slots;
+		s.slots++;
+	}
+	return s;
+}
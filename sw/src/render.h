@@ -0,0 +1,149 @@
+// -------------------------------------------------------------------------
+// LED rendering
+//
+// render.h: conversion of measurements into PWM bitplanes
+//
+// Website: https://github.com/tomek-szczesny/pistackmon
+// Authors: Tomek Szczesny, Bernhard Bablok
+// License: GPL3
+// -------------------------------------------------------------------------
+
+#ifndef _RENDER_H
+#define _RENDER_H
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <type_traits>
+#include <vector>
+
+#include "config.h"
+#include "supervisor.h"
+
+// Input levels of LEDs are fixed point fractions of a full LED,
+// LEVEL_ONE being fully lit.
+#define LEVEL_BITS 16
+#define LEVEL_ONE  (1 << LEVEL_BITS)
+
+// Gamma LUTs have 2^LUT_BITS steps, interpolated linearly in between
+#define LUT_BITS   8
+#define LUT_STEPS  (1 << LUT_BITS)
+
+// LED drivers may be daisy-chained, W being the number of outputs
+// of the whole chain (CHAIN_WIDTH is set from the makefile).
+// Outputs 0-15 belong to the driver nearest to the Pi, which is
+// the only one on stock PiStackMon boards.
+// ChainWord<W>::type is the smallest integer holding one bit of each output.
+template <int W>
+struct ChainWord {
+	static_assert(W % 16 == 0 && W >= 16 && W <= 64,
+		      "Chain width must be a multiple of 16, up to 64");
+	typedef typename std::conditional<(W <= 16), uint16_t,
+		typename std::conditional<(W <= 32), uint32_t,
+		uint64_t>::type>::type type;
+};
+
+// Duty cycles of each LED, in units of PWM LSB
+template <int W>
+using led_duties_t = std::array<uint16_t, W>;
+
+// Bitplanes for PWM() thread to work on
+// Each item contains W bits to be passed to LED driver chain.
+// Items are ordered from the least to most significant bits
+// in terms of PWM modulation, only the first pwm_res are meaningful.
+template <int W>
+using pwm_planes_t = std::array<typename ChainWord<W>::type, 16>;
+
+// One PWM cycle of a frame, as the PWM thread executes it.
+// Runs of identical adjacent bitplanes are merged into one slot lasting
+// as long as the whole run, so the same data is not shifted and latched
+// again. Only the first slots are meaningful.
+// The fan, if driven by software PWM, is one more bit of each bitplane,
+// so it takes part in merging too.
+template <int W>
+struct pwm_schedule_t {
+	int slots;
+	pwm_planes_t<W> planes;
+	std::array<std::chrono::microseconds, 16> periods;
+	std::array<std::chrono::nanoseconds, 16> on_times;
+	bool fan_used;		// the fan is driven by software PWM
+	uint16_t fan;		// bit per slot, set if the fan is on in it
+};
+
+typedef led_duties_t<CHAIN_WIDTH> led_duties_datatype;
+typedef pwm_planes_t<CHAIN_WIDTH> pwm_data_datatype;
+typedef pwm_schedule_t<CHAIN_WIDTH> pwm_schedule_datatype;
+
+// Bars, as laid out in render.cpp: cpu, ram and temp bars of the stock
+// board, then extension bars (see EXT_BARS)
+enum Bar { BAR_CPU, BAR_RAM, BAR_TEMP, BAR_EXT };
+#define BARS (BAR_EXT + EXT_BARS)
+
+// Fill of each bar (0-1)
+typedef std::array<float, BARS> bar_fills_datatype;
+
+// Level of each bar above which it is dimmed by split_dim (0-1),
+// 1 or more for none
+typedef std::array<float, BARS> bar_splits_datatype;
+
+// Tables derived from the config, used by both threads.
+// These are never modified once built. A new set is built by the main thread
+// on every config reload, and published along with the first pwm_data frame
+// rendered with it, so the PWM thread picks both up at a cycle boundary.
+struct PwmParams {
+	int pwm_res;
+	// Precalculated PWM periods, one for each bit
+	std::vector<std::chrono::microseconds> pwm_periods;
+	// Global brightness is applied by blanking all LEDs for a part of each
+	// PWM slot, so LED duty cycles keep their full resolution.
+	// pwm_on_times are the unblanked parts of each slot.
+	bool gated;
+	std::vector<std::chrono::nanoseconds> pwm_on_times;
+	// Duty cycle of each LED against its input level, with gamma correction
+	// and color multipliers applied. lut[i][LUT_STEPS] is the duty of
+	// a fully lit LED.
+	uint16_t lut[CHAIN_WIDTH][LUT_STEPS + 1];
+	// In static mode (see supervisor.h) a LED is lit if its duty is at
+	// least that of a half-lit LED, and fully lit then
+	uint16_t static_threshold[CHAIN_WIDTH];
+	// Level of the dimmed part of a split bar, relative to a full LED
+	int32_t split_dim;
+	FallbackSettings fallback;
+};
+
+PwmParams *buildPwmParams(const Config &c);
+
+// Converts fills of each bar and the user LED (0-1) into duty cycles
+// of each LED. Bars are dimmed above their splits, if given.
+led_duties_datatype led_pwms(const PwmParams &p,
+			     const bar_fills_datatype &fills, float user,
+			     const bar_splits_datatype *splits = nullptr);
+
+// Merges identical adjacent bitplanes of a frame into PWM slots.
+// fan - duty of a fan driven by software PWM (0-1), -1 if there is none
+pwm_schedule_datatype compactSchedule(const PwmParams &p,
+				      const pwm_data_datatype &planes,
+				      float fan = -1);
+
+// Transposes duty cycles of 16 LEDs into 16 bitplanes
+void transpose16(const uint16_t *duties, uint16_t *planes);
+
+// Converts duty cycles of each LED into bitplanes,
+// one 16 LED block at a time
+template <int W>
+pwm_planes_t<W> format_pwms(const led_duties_t<W> &duties) {
+	typedef typename ChainWord<W>::type word;
+	pwm_planes_t<W> planes;
+	uint16_t block[16];
+
+	transpose16(&duties[0], block);
+	for (int i = 0; i < 16; i++) planes[i] = block[i];
+	for (int b = 1; b < W / 16; b++) {
+		transpose16(&duties[16 * b], block);
+		for (int i = 0; i < 16; i++)
+			planes[i] |= static_cast<word>(block[i]) << (16 * b);
+	}
+	return planes;
+}
+
+#endif
@@ -0,0 +1,319 @@
+// -------------------------------------------------------------------------
+// Batched sampling
+//
+// sampler.cpp: reads all metric files of a sample in one pass, with io_uring
+// where available
+//
+// Website: https://github.com/tomek-szczesny/pistackmon
+// Authors: Tomek Szczesny, Bernhard Bablok
+// License: GPL3
+// -------------------------------------------------------------------------
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include <fcntl.h>		// open()
+#include <unistd.h>		// pread(), syscall()
+#include <sys/mman.h>		// mmap()
+#include <sys/syscall.h>	// __NR_io_uring_*
+#include <sys/uio.h>		// iovec
+
+// The ring is set up with raw system calls, so liburing is not needed.
+// Without kernel headers knowing io_uring, pread() is all there is.
+#if __has_include(<linux/io_uring.h>) && defined(__NR_io_uring_setup)
+#include <linux/io_uring.h>
+#define HAVE_IO_URING
+#endif
+
+#include "sampler.h"
+
+//================================== ENGINE ====================================
+
+bool Sampler::open(bool io_uring, std::string &err) {
+	closeRing();
+	if (!io_uring) return true;
+#ifdef HAVE_IO_URING
+	if (setupRing(8)) return true;
+	err = std::strerror(errno);
+#else
+	err = "not supported by this build";
+#endif
+	return false;
+}
+
+//  -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -
+
+bool Sampler::setupRing(unsigned n) {
+	// Maps both rings and submission entries.
+	// A failed setup leaves nothing behind.
+
+#ifdef HAVE_IO_URING
+	io_uring_params p;
+	std::memset(&p, 0, sizeof(p));
+	int fd = syscall(__NR_io_uring_setup, n, &p);
+	if (fd < 0) return false;
+	ring_fd = fd;
+
+	sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+	bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+	if (single) sq_ring_size = cq_ring_size = std::max(sq_ring_size, cq_ring_size);
+	sqes_size = p.sq_entries * sizeof(io_uring_sqe);
+
+	auto map = [&](size_t size, off_t what) -> void * {
+		void *ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+				 MAP_SHARED | MAP_POPULATE, fd, what);
+		return ptr == MAP_FAILED ? nullptr : ptr;
+	};
+	sq_ring = map(sq_ring_size, IORING_OFF_SQ_RING);
+	cq_ring = single ? sq_ring : map(cq_ring_size, IORING_OFF_CQ_RING);
+	sqes = map(sqes_size, IORING_OFF_SQES);
+	if (!sq_ring || !cq_ring || !sqes) {
+		int e = errno;
+		closeRing();
+		errno = e;
+		return false;
+	}
+
+	char *sq = static_cast<char *>(sq_ring);
+	sq_tail = reinterpret_cast<unsigned *>(sq + p.sq_off.tail);
+	sq_mask = reinterpret_cast<unsigned *>(sq + p.sq_off.ring_mask);
+	sq_array = reinterpret_cast<unsigned *>(sq + p.sq_off.array);
+	char *cq = static_cast<char *>(cq_ring);
+	cq_head = reinterpret_cast<unsigned *>(cq + p.cq_off.head);
+	cq_tail = reinterpret_cast<unsigned *>(cq + p.cq_off.tail);
+	cq_mask = reinterpret_cast<unsigned *>(cq + p.cq_off.ring_mask);
+	cqes = cq + p.cq_off.cqes;
+	entries = p.sq_entries;
+	registered = false;
+	return true;
+#else
+	(void) n;
+	errno = ENOSYS;
+	return false;
+#endif
+}
+
+//  -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -
+
+void Sampler::closeRing() {
+	// Closing the ring drops registered files and buffers along with it
+
+	if (sqes) munmap(sqes, sqes_size);
+	if (cq_ring && cq_ring != sq_ring) munmap(cq_ring, cq_ring_size);
+	if (sq_ring) munmap(sq_ring, sq_ring_size);
+	sqes = sq_ring = cq_ring = nullptr;
+	if (ring_fd != -1) ::close(ring_fd);
+	ring_fd = -1;
+	entries = 0;
+	fixed_files = fixed_buffers = false;
+	registered = false;
+}
+
+//  -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -
+
+bool Sampler::registerRing() {
+	// Registers files and the arena, again whenever either has changed.
+	// The ring grows if there are more files than entries.
+	// Files or buffers the kernel refuses to register are read
+	// unregistered, which is slower but still a single submission.
+
+#ifdef HAVE_IO_URING
+	if (files.size() > entries) {
+		unsigned n = std::max(entries, 8u);
+		while (n < files.size()) n *= 2;
+		closeRing();
+		if (!setupRing(n)) return false;
+	}
+	if (fixed_files) {
+		syscall(__NR_io_uring_register, ring_fd, IORING_UNREGISTER_FILES, nullptr, 0);
+		calls++;
+	}
+	if (fixed_buffers) {
+		syscall(__NR_io_uring_register, ring_fd, IORING_UNREGISTER_BUFFERS, nullptr, 0);
+		calls++;
+	}
+
+	std::vector<int> fds;
+	for (auto &f : files) fds.push_back(f.fd);
+	fixed_files = syscall(__NR_io_uring_register, ring_fd, IORING_REGISTER_FILES,
+			      fds.data(), fds.size()) == 0;
+	iovec iov = {arena.data(), arena.size()};
+	fixed_buffers = syscall(__NR_io_uring_register, ring_fd, IORING_REGISTER_BUFFERS,
+				&iov, 1) == 0;
+	calls += 2;
+	registered = true;
+	return true;
+#else
+	return false;
+#endif
+}
+
+//================================== FILES =====================================
+
+int Sampler::add(const std::string &path, size_t size) {
+	int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd == -1) return -1;
+	int i = add(fd, size);
+	files[i].owned = true;
+	return i;
+}
+
+//  -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -
+
+int Sampler::add(int fd, size_t size) {
+	if (fd < 0) return -1;
+	File f;
+	f.fd = fd;
+	f.owned = false;
+	f.offset = 0;
+	f.size = std::max<size_t>(size, 16);
+	files.push_back(f);
+	layout();
+	return files.size() - 1;
+}
+
+//  -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -
+
+void Sampler::layout() {
+	// Lays buffers out in a new arena, keeping their contents.
+	// The arena is registered as a whole, so the ring needs to know.
+
+	std::vector<char> a;
+	size_t total = 0;
+	for (auto &f : files) total += f.size;
+	a.resize(total);
+	size_t offset = 0;
+	for (auto &f : files) {
+		if (f.len >= 0) std::memcpy(a.data() + offset, arena.data() + f.offset, f.len + 1);
+		f.offset = offset;
+		offset += f.size;
+	}
+	arena.swap(a);
+	registered = false;
+}
+
+//  -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -
+
+void Sampler::clear() {
+	for (auto &f : files) {
+		if (f.owned) ::close(f.fd);
+	}
+	files.clear();
+	arena.clear();
+	registered = false;
+}
+
+//  -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -
+
+void Sampler::close() {
+	clear();
+	closeRing();
+}
+
+//================================== READING ===================================
+
+void Sampler::read() {
+	if (files.empty()) return;
+	if (ring_fd != -1 && !registered && !registerRing()) closeRing();
+	if (ring_fd == -1 || !readRing()) {
+		for (auto &f : files) readPlain(f);
+		return;
+	}
+
+	// Files that filled their buffers are read again, with more room
+	for (auto &f : files) {
+		if (f.len == static_cast<int>(f.size) - 1) readPlain(f);
+	}
+}
+
+//  -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -
+
+void Sampler::readPlain(File &f) {
+	// One pread() from the beginning. Kernel tables and attributes are
+	// generated whole on a read, so a short one is the whole file.
+
+	while (true) {
+		ssize_t len = pread(f.fd, arena.data() + f.offset, f.size - 1, 0);
+		calls++;
+		if (len < 0) {
+			f.len = -1;
+			return;
+		}
+		if (static_cast<size_t>(len) < f.size - 1) {
+			f.len = len;
+			arena[f.offset + len] = 0;
+			return;
+		}
+		f.len = -1;
+		f.size *= 2;
+		layout();
+	}
+}
+
+//  -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -
+
+bool Sampler::readRing() {
+	// Queues a read of every file, then submits them and waits for
+	// all completions in the same io_uring_enter(). Signals may cut
+	// the wait short, it is resumed then.
+	// Returns false if the ring cannot be used, and closes it.
+
+#ifdef HAVE_IO_URING
+	const unsigned n = files.size();
+	const unsigned mask = *sq_mask;
+	unsigned tail = *sq_tail;
+	for (unsigned i = 0; i < n; i++) {
+		const File &f = files[i];
+		unsigned idx = tail & mask;
+		io_uring_sqe *sqe = static_cast<io_uring_sqe *>(sqes) + idx;
+		std::memset(sqe, 0, sizeof(*sqe));
+		sqe->opcode = fixed_buffers ? IORING_OP_READ_FIXED : IORING_OP_READ;
+		sqe->flags = fixed_files ? IOSQE_FIXED_FILE : 0;
+		sqe->fd = fixed_files ? static_cast<int>(i) : f.fd;
+		sqe->addr = reinterpret_cast<uint64_t>(arena.data() + f.offset);
+		sqe->len = f.size - 1;
+		sqe->off = 0;
+		sqe->buf_index = 0;
+		sqe->user_data = i;
+		sq_array[idx] = idx;
+		tail++;
+	}
+	__atomic_store_n(sq_tail, tail, __ATOMIC_RELEASE);
+
+	unsigned submitted = 0, done = 0;
+	bool unsupported = false;
+	while (done < n) {
+		int r = syscall(__NR_io_uring_enter, ring_fd, n - submitted, n - done,
+				IORING_ENTER_GETEVENTS, nullptr, 0);
+		calls++;
+		if (r < 0 && errno != EINTR && errno != EAGAIN) {
+			closeRing();
+			return false;
+		}
+		if (r > 0) submitted += r;
+
+		unsigned head = *cq_head;
+		unsigned ctail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+		for (; head != ctail; head++) {
+			const io_uring_cqe *cqe = static_cast<const io_uring_cqe *>(cqes) +
+						  (head & *cq_mask);
+			File &f = files[cqe->user_data];
+			f.len = cqe->res < 0 ? -1 : cqe->res;
+			if (f.len >= 0) arena[f.offset + f.len] = 0;
+			// Unregistered reads are not known to kernels before 5.6
+			if (cqe->res == -EINVAL) unsupported = true;
+			done++;
+		}
+		__atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+	}
+	if (unsupported) {
+		closeRing();
+		return false;
+	}
+	return true;
+#else
+	return false;
+#endif
+}
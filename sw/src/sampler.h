@@ -0,0 +1,101 @@
+// -------------------------------------------------------------------------
+// Batched sampling
+//
+// sampler.h: reads all metric files of a sample in one pass, with io_uring
+// where available
+//
+// Website: https://github.com/tomek-szczesny/pistackmon
+// Authors: Tomek Szczesny, Bernhard Bablok
+// License: GPL3
+// -------------------------------------------------------------------------
+
+#ifndef _SAMPLER_H
+#define _SAMPLER_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class Sampler {
+	// Reads a set of files kept open (proc tables, sysfs attributes),
+	// every one of them from the beginning into a buffer of its own,
+	// all in one pass. Buffers grow if a read fills them.
+	//
+	// With io_uring, files and buffers are registered with the kernel
+	// once, and a pass is a single io_uring_enter() submitting a fixed
+	// buffer read of each file and waiting for all of them to complete.
+	// Otherwise each file costs a pread().
+
+	private:
+	struct File {
+		int fd;
+		bool owned;		// opened by add(path), closed by clear()
+		size_t offset;		// of its buffer in the arena
+		size_t size;
+		int len = -1;		// of the last read, -1 on failure
+	};
+	std::vector<File> files;
+	std::vector<char> arena;
+	bool registered = false;	// files and arena as the ring knows them
+	uint64_t calls = 0;
+
+	// io_uring, ring_fd is -1 if not in use
+	int ring_fd = -1;
+	unsigned entries = 0;
+	bool fixed_files = false;
+	bool fixed_buffers = false;
+	void *sq_ring = nullptr;
+	void *cq_ring = nullptr;
+	size_t sq_ring_size = 0;
+	size_t cq_ring_size = 0;
+	void *sqes = nullptr;
+	size_t sqes_size = 0;
+	unsigned *sq_tail = nullptr, *sq_mask = nullptr, *sq_array = nullptr;
+	unsigned *cq_head = nullptr, *cq_tail = nullptr, *cq_mask = nullptr;
+	void *cqes = nullptr;
+
+	bool setupRing(unsigned n);
+	void closeRing();
+	bool registerRing();
+	void layout();
+	bool readRing();
+	void readPlain(File &f);
+
+	public:
+	~Sampler() { close(); }
+
+	// Sets the engine up, io_uring if asked for and available.
+	// Returns false if it is not, pread() is used then and err says why.
+	bool open(bool io_uring, std::string &err);
+
+	// Adds a file, to be read on every pass from now on. Returns its
+	// index, or -1 if it cannot be opened. A file added by its fd stays
+	// owned by the caller, and must be kept open until clear().
+	int add(const std::string &path, size_t size = 4096);
+	int add(int fd, size_t size = 4096);
+
+	// Reads every file
+	void read();
+
+	// Null-terminated contents of a file as of the last read(),
+	// or nullptr if it has failed, or i is -1
+	const char *data(int i) const {
+		if (i < 0 || files[i].len < 0) return nullptr;
+		return arena.data() + files[i].offset;
+	}
+
+	// "io_uring" or "pread"
+	const char *engine() const { return ring_fd != -1 ? "io_uring" : "pread"; }
+
+	size_t size() const { return files.size(); }
+
+	// System calls made by read() so far
+	uint64_t syscalls() const { return calls; }
+
+	// Forgets every file, closing those added by path
+	void clear();
+
+	void close();
+};
+
+#endif
@@ -0,0 +1,286 @@
+// -------------------------------------------------------------------------
+// Self-overhead accounting
+//
+// selfstats.cpp: CPU time, wakeups and memory used by pistackmond itself
+//
+// Website: https://github.com/tomek-szczesny/pistackmon
+// Authors: Tomek Szczesny, Bernhard Bablok
+// License: GPL3
+// -------------------------------------------------------------------------
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <sstream>
+#include <string>
+
+#include <fcntl.h>		// open()
+#include <unistd.h>		// read(), close()
+#include <sys/mman.h>		// mmap(), shm_open()
+#include <sys/resource.h>	// getrusage()
+#include <sys/stat.h>		// fchmod()
+
+#include "selfstats.h"
+#include "supervisor.h"
+
+//=================================== MISC =====================================
+
+static double seconds(const timespec &ts) {
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+//  -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -
+
+static bool readSmallFile(const char *path, char *buf, size_t size) {
+	// Reads up to size-1 bytes of a file into a null-terminated buffer
+
+	int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+	if (fd == -1) return false;
+	ssize_t len = read(fd, buf, size - 1);
+	::close(fd);
+	if (len < 0) return false;
+	buf[len] = 0;
+	return true;
+}
+
+//  -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -
+
+static uint64_t statusField(const char *buf, const char *name) {
+	// Returns a numeric field from /proc/.../status contents
+
+	const char *p = std::strstr(buf, name);
+	if (!p) return 0;
+	return std::strtoull(p + std::strlen(name), nullptr, 10);
+}
+
+//============================== SelfMonitor ===================================
+
+bool SelfMonitor::open(pthread_t pwm_thread, int pwm_tid,
+		       const std::string &path) {
+	this->pwm_tid = pwm_tid;
+	this->path = path;
+	if (pthread_getcpuclockid(pwm_thread, &pwm_clock) != 0) {
+		perror("pthread_getcpuclockid failed");
+		return false;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	// Only the daemon may write, anyone may read
+	shm_unlink(path.c_str());
+	int fd = shm_open(path.c_str(), O_RDWR | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR);
+	if (fd == -1) {
+		perror("shm_open failed");
+		return false;
+	}
+	fchmod(fd, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+	if (ftruncate(fd, sizeof(SelfStats)) == -1) {
+		perror("ftruncate failed");
+		::close(fd);
+		shm_unlink(path.c_str());
+		return false;
+	}
+	void *map = mmap(NULL, sizeof(SelfStats), PROT_READ | PROT_WRITE,
+			 MAP_SHARED, fd, 0);
+	::close(fd);
+	if (map == MAP_FAILED) {
+		perror("mmap failed");
+		shm_unlink(path.c_str());
+		return false;
+	}
+	stats = new (map) SelfStats();
+	stats->version = STATS_VERSION;
+	return true;
+}
+
+//  -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -
+
+void SelfMonitor::update(uint64_t pwm_slots, uint64_t pwm_late_slots,
+			 uint64_t pwm_shifts, uint64_t pwm_shifts_avoided,
+			 int governor_level, float cpu_capacity, int throttled,
+			 float fan_duty, uint64_t fan_starts, uint64_t samples,
+			 const PwmHealth &pwm) {
+	// Must be called from the main thread, as RUSAGE_THREAD
+	// and CLOCK_THREAD_CPUTIME_ID describe the calling thread.
+
+	if (!stats) return;
+
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	double now = seconds(ts) - seconds(start);
+	clock_gettime(pwm_clock, &ts);
+	double pwm_cpu = seconds(ts);
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	double main_cpu = seconds(ts);
+
+	rusage ru;
+	getrusage(RUSAGE_THREAD, &ru);
+
+	char buf[2048];
+	char status_path[64];
+	uint64_t pwm_vol = 0, pwm_invol = 0;
+	std::snprintf(status_path, sizeof(status_path), "/proc/self/task/%d/status", pwm_tid);
+	if (readSmallFile(status_path, buf, sizeof(buf))) {
+		pwm_vol = statusField(buf, "\nvoluntary_ctxt_switches:");
+		pwm_invol = statusField(buf, "\nnonvoluntary_ctxt_switches:");
+	}
+	uint64_t rss = 0;
+	if (readSmallFile("/proc/self/statm", buf, sizeof(buf))) {
+		unsigned long size, resident;
+		if (std::sscanf(buf, "%lu %lu", &size, &resident) == 2)
+			rss = static_cast<uint64_t>(resident) * sysconf(_SC_PAGESIZE);
+	}
+
+	Snapshot s;
+	s.t = now;
+	s.cpu_time = pwm_cpu + main_cpu;
+	s.voluntary_ctxsw = pwm_vol + ru.ru_nvcsw;
+	s.shifts_avoided = pwm_shifts_avoided;
+	s.samples = samples;
+	double dt = s.t - last.t;
+
+	// Seqlock: the odd count has to be visible before any of the fields,
+	// and all of them before the even one
+	uint32_t seq = stats->seq.load(std::memory_order_relaxed) + 1;
+	stats->seq.store(seq, std::memory_order_relaxed);	// odd - updating
+	std::atomic_thread_fence(std::memory_order_release);
+	stats->uptime = now;
+	stats->pwm_cpu_time = pwm_cpu;
+	stats->main_cpu_time = main_cpu;
+	if (dt > 0) {
+		stats->cpu = 100 * (s.cpu_time - last.cpu_time) / dt;
+		// Every voluntary context switch is a sleep, followed by a wakeup
+		stats->wakeups = (s.voluntary_ctxsw - last.voluntary_ctxsw) / dt;
+		stats->shifts_avoided = (s.shifts_avoided - last.shifts_avoided) / dt;
+	}
+	stats->pwm_voluntary_ctxsw = pwm_vol;
+	stats->pwm_involuntary_ctxsw = pwm_invol;
+	stats->main_voluntary_ctxsw = ru.ru_nvcsw;
+	stats->main_involuntary_ctxsw = ru.ru_nivcsw;
+	stats->rss = rss;
+	stats->pwm_slots = pwm_slots;
+	stats->pwm_late_slots = pwm_late_slots;
+	stats->pwm_shifts = pwm_shifts;
+	stats->pwm_shifts_avoided = pwm_shifts_avoided;
+	stats->governor_level = governor_level;
+	stats->cpu_capacity = cpu_capacity;
+	stats->throttled = throttled;
+	stats->samples = samples;
+	if (now > 0) stats->sample_rate = samples / now;
+	stats->fan_duty = fan_duty;
+	stats->fan_starts = fan_starts;
+	stats->pwm = pwm;
+	stats->seq.store(seq + 1, std::memory_order_release);	// even - done
+
+	last = s;
+}
+
+//  -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -
+
+std::string SelfMonitor::summary(double &cpu) {
+	std::ostringstream ss;
+	double dt = last.t - interval.t;
+	cpu = 0;
+	if (!stats || dt <= 0) return "";
+
+	cpu = 100 * (last.cpu_time - interval.cpu_time) / dt;
+	double wakeups = (last.voluntary_ctxsw - interval.voluntary_ctxsw) / dt;
+	double shifts_avoided = (last.shifts_avoided - interval.shifts_avoided) / dt;
+	double sample_rate = (last.samples - interval.samples) / dt;
+	ss.setf(std::ios::fixed);
+	ss.precision(2);
+	ss << "Self: cpu " << cpu << "% over " << static_cast<int>(dt) << "s" <<
+	      " (total pwm " << stats->pwm_cpu_time << "s, main " <<
+	      stats->main_cpu_time << "s), wakeups " << wakeups << "/s" <<
+	      ", ctxsw pwm " << stats->pwm_voluntary_ctxsw << "/" <<
+	      stats->pwm_involuntary_ctxsw << " main " <<
+	      stats->main_voluntary_ctxsw << "/" <<
+	      stats->main_involuntary_ctxsw <<
+	      ", rss " << stats->rss / 1024 << "KiB" <<
+	      ", shifts avoided " << shifts_avoided << "/s" <<
+	      ", samples " << sample_rate << "/s" <<
+	      ", governor " << stats->governor_level;
+	if (stats->fan_duty >= 0) ss << ", fan " << stats->fan_duty << "%";
+	if (stats->pwm.mode == MODE_STATIC) ss << ", static LEDs";
+	interval = last;
+	return ss.str();
+}
+
+//  -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -
+
+void SelfMonitor::close() {
+	if (!stats) return;
+	munmap(stats, sizeof(SelfStats));
+	shm_unlink(path.c_str());
+	stats = nullptr;
+}
+
+//================================ READER ======================================
+
+bool printStats() {
+	int fd = shm_open(STATS_PATH, O_RDONLY, 0);
+	if (fd == -1) {
+		perror("shm_open failed (is pistackmond running?)");
+		return false;
+	}
+	void *map = mmap(NULL, sizeof(SelfStats), PROT_READ, MAP_SHARED, fd, 0);
+	::close(fd);
+	if (map == MAP_FAILED) {
+		perror("mmap failed");
+		return false;
+	}
+	const SelfStats *shared = static_cast<const SelfStats *>(map);
+	if (shared->version != STATS_VERSION) {
+		std::fprintf(stderr, "Stats version mismatch\n");
+		munmap(map, sizeof(SelfStats));
+		return false;
+	}
+
+	// Copies the stats, retrying if the daemon has been updating them
+	// in the meantime. The fence keeps the copy from being read after
+	// the sequence number is checked again.
+	SelfStats s;
+	uint32_t seq;
+	do {
+		seq = shared->seq.load(std::memory_order_acquire);
+		std::memcpy(static_cast<void *>(&s), shared, sizeof(s));
+		std::atomic_thread_fence(std::memory_order_acquire);
+	} while ((seq & 1) || seq != shared->seq.load(std::memory_order_relaxed));
+	munmap(map, sizeof(SelfStats));
+
+	std::printf("uptime %.0f\n", s.uptime);
+	std::printf("cpu %.3f\n", s.cpu);
+	std::printf("pwm_cpu_time %.3f\n", s.pwm_cpu_time);
+	std::printf("main_cpu_time %.3f\n", s.main_cpu_time);
+	std::printf("wakeups %.1f\n", s.wakeups);
+	std::printf("pwm_voluntary_ctxsw %llu\n",
+		    (unsigned long long) s.pwm_voluntary_ctxsw);
+	std::printf("pwm_involuntary_ctxsw %llu\n",
+		    (unsigned long long) s.pwm_involuntary_ctxsw);
+	std::printf("main_voluntary_ctxsw %llu\n",
+		    (unsigned long long) s.main_voluntary_ctxsw);
+	std::printf("main_involuntary_ctxsw %llu\n",
+		    (unsigned long long) s.main_involuntary_ctxsw);
+	std::printf("rss %llu\n", (unsigned long long) s.rss);
+	std::printf("pwm_slots %llu\n", (unsigned long long) s.pwm_slots);
+	std::printf("pwm_late_slots %llu\n",
+		    (unsigned long long) s.pwm_late_slots);
+	std::printf("pwm_shifts %llu\n", (unsigned long long) s.pwm_shifts);
+	std::printf("pwm_shifts_avoided %llu\n",
+		    (unsigned long long) s.pwm_shifts_avoided);
+	std::printf("shifts_avoided %.1f\n", s.shifts_avoided);
+	std::printf("governor_level %d\n", s.governor_level);
+	std::printf("samples %llu\n", (unsigned long long) s.samples);
+	std::printf("sample_rate %.3f\n", s.sample_rate);
+	std::printf("cpu_capacity %.3f\n", s.cpu_capacity);
+	if (s.throttled >= 0) std::printf("throttled 0x%x\n", s.throttled);
+	if (s.fan_duty >= 0) {
+		std::printf("fan_duty %.1f\n", s.fan_duty);
+		std::printf("fan_starts %llu\n", (unsigned long long) s.fan_starts);
+	}
+	std::printf("pwm_mode %s\n", s.pwm.mode == MODE_STATIC ? "static" : "pwm");
+	std::printf("pwm_miss_ratio %.2f\n", s.pwm.miss_ratio);
+	std::printf("pwm_fallbacks %llu\n", (unsigned long long) s.pwm.fallbacks);
+	std::printf("pwm_probes %llu\n", (unsigned long long) s.pwm.probes);
+	return true;
+}
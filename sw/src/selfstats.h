@@ -0,0 +1,117 @@
+// -------------------------------------------------------------------------
+// Self-overhead accounting
+//
+// selfstats.h: CPU time, wakeups and memory used by pistackmond itself
+//
+// Website: https://github.com/tomek-szczesny/pistackmon
+// Authors: Tomek Szczesny, Bernhard Bablok
+// License: GPL3
+// -------------------------------------------------------------------------
+
+#ifndef _SELFSTATS_H
+#define _SELFSTATS_H
+
+#include <atomic>
+#include <cstdint>
+#include <ctime>
+#include <string>
+
+#include <pthread.h>
+
+// Read-only shared memory region with the stats, refreshed every second
+#define STATS_PATH "/pistackmond-stats"
+#define STATS_VERSION 6
+
+// PWM supervisor state (see supervisor.h)
+struct PwmHealth {
+	int32_t mode;			// PwmMode
+	float miss_ratio;		// Late slots over the window [%]
+	uint64_t fallbacks;		// Switches to static mode
+	uint64_t probes;		// Attempts to return to PWM
+};
+
+struct SelfStats {
+	uint32_t version;
+	// Odd while the daemon is updating the stats
+	std::atomic<uint32_t> seq;
+
+	double uptime;			// [s]
+	double pwm_cpu_time;		// PWM thread CPU time [s]
+	double main_cpu_time;		// Main thread CPU time [s]
+	double cpu;			// Both threads over the last second
+					// [% of one CPU]
+	double wakeups;			// Both threads, over the last second [1/s]
+	uint64_t pwm_voluntary_ctxsw;
+	uint64_t pwm_involuntary_ctxsw;
+	uint64_t main_voluntary_ctxsw;
+	uint64_t main_involuntary_ctxsw;
+	uint64_t rss;			// [bytes]
+
+	uint64_t pwm_slots;		// PWM slots executed
+	uint64_t pwm_late_slots;	// PWM slots started late
+	uint64_t pwm_shifts;		// Frames shifted into the LED drivers
+	uint64_t pwm_shifts_avoided;	// Bitplanes not shifted, being merged
+					// or already in the drivers
+	double shifts_avoided;		// Over the last second [1/s]
+	int32_t governor_level;
+
+	float cpu_capacity;		// Mean CPU frequency relative to maximum
+	int32_t throttled;		// Firmware throttling flags, -1 if n/a
+
+	uint64_t samples;		// Samples taken
+	double sample_rate;		// Mean since start [Hz]
+
+	float fan_duty;			// [%], -1 if no fan is driven
+	uint64_t fan_starts;		// Fan spin-ups
+
+	PwmHealth pwm;
+};
+
+class SelfMonitor {
+	// Samples pistackmond's own resource usage and publishes it through
+	// the shared memory region above.
+	// The interval summary is a one-line log of averages over the last
+	// stats_interval seconds.
+
+	private:
+	SelfStats *stats = nullptr;
+	clockid_t pwm_clock;
+	int pwm_tid = 0;
+	std::string path;
+	timespec start;
+
+	// Values at the last sample and at the beginning of the interval
+	struct Snapshot {
+		double t = 0;
+		double cpu_time = 0;
+		uint64_t voluntary_ctxsw = 0;
+		uint64_t shifts_avoided = 0;
+		uint64_t samples = 0;
+	} last, interval;
+
+	public:
+
+	// Creates the shared memory region. Returns false on failure.
+	bool open(pthread_t pwm_thread, int pwm_tid,
+		  const std::string &path = STATS_PATH);
+
+	// Refreshes the stats, to be called once a second.
+	// Extra fields come from the daemon, as they are tracked elsewhere.
+	void update(uint64_t pwm_slots, uint64_t pwm_late_slots,
+		    uint64_t pwm_shifts, uint64_t pwm_shifts_avoided,
+		    int governor_level, float cpu_capacity, int throttled,
+		    float fan_duty, uint64_t fan_starts, uint64_t samples,
+		    const PwmHealth &pwm);
+
+	// Summarizes the interval since the last call in one line,
+	// and starts a new one.
+	// cpu is set to the mean CPU usage over the interval [% of one CPU].
+	std::string summary(double &cpu);
+
+	void close();
+};
+
+// Prints stats published by a running daemon. Returns false on failure.
+bool printStats();
+
+#endif
@@ -0,0 +1,883 @@
+// -------------------------------------------------------------------------
+// Simulation harness
+//
+// sim.cpp: runs the pistackmond service on fixture files and simulated
+// time, checking frames latched into an emulated LED driver chain
+//
+// Website: https://github.com/tomek-szczesny/pistackmon
+// Authors: Tomek Szczesny, Bernhard Bablok
+// License: GPL3
+// -------------------------------------------------------------------------
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdarg>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>	// open()
+#include <unistd.h>	// getpid(), pwrite(), rmdir(), unlink()
+#include <sys/stat.h>	// mkdir()
+
+#include "clock.h"
+#include "config.h"
+#include "metrics.h"
+#include "pistackmond.h"
+#include "pwm.h"
+#include "render.h"
+#include "supervisor.h"
+#include "driver.h"
+
+using namespace std::chrono_literals;
+
+//================================ SIMULATED CLOCK =============================
+
+class SimClock : public Clock {
+	// Discrete event simulation of time.
+	// Threads taking part run one at a time: the one going to sleep hands
+	// over to the one due first (the lower id first on a tie), and time
+	// jumps straight to its wakeup. The script runs in between, whenever
+	// it is due, while no thread runs.
+	// Execution is serialized this way, so a run is repeatable however
+	// the OS schedules threads.
+
+	private:
+	struct Sleeper {
+		time_point wake;
+		int id;
+	};
+
+	std::mutex m;
+	std::vector<std::unique_ptr<std::condition_variable>> cvs;	// per id
+	std::vector<Sleeper> sleepers;
+	std::vector<duration> lateness;					// per id
+	time_point t;
+	int running = 1;	// threads running, or expected to enter
+	int turn = -1;		// thread to run next
+	static thread_local int self;
+
+	std::function<time_point(time_point)> script;
+	time_point script_at = time_point::max();
+
+	std::condition_variable *handOver();
+	void block(std::unique_lock<std::mutex> &lock, time_point wake);
+
+	public:
+	// The calling thread takes part as id 0
+	explicit SimClock(time_point start) : t(start) {
+		cvs.emplace_back(new std::condition_variable);
+		lateness.push_back(duration::zero());
+	}
+
+	// Changes only while the caller sleeps, so needs no lock
+	time_point now() override { return t; }
+
+	void sleepUntil(time_point wake) override {
+		std::unique_lock<std::mutex> lock(m);
+		block(lock, wake + lateness[self]);
+	}
+
+	// Spinning never gets late
+	void spinUntil(time_point wake) override {
+		std::unique_lock<std::mutex> lock(m);
+		block(lock, wake);
+	}
+
+	bool simulated() const override { return true; }
+
+	void expect() override {
+		std::lock_guard<std::mutex> lock(m);
+		running++;
+	}
+
+	void enter() override {
+		// Thread ids follow the order of entering.
+		// The new thread waits for its turn, as if it slept until now.
+		std::unique_lock<std::mutex> lock(m);
+		self = cvs.size();
+		cvs.emplace_back(new std::condition_variable);
+		lateness.push_back(duration::zero());
+		block(lock, t);
+	}
+
+	void leave() override {
+		std::unique_lock<std::mutex> lock(m);
+		running--;
+		std::condition_variable *cv = handOver();
+		lock.unlock();
+		if (cv) cv->notify_one();
+	}
+
+	// Runs f at first, then whenever the time it returns comes
+	void setScript(std::function<time_point(time_point)> f, time_point first) {
+		script = f;
+		script_at = first;
+	}
+
+	// Delays every wakeup of a thread, as a starved CPU would.
+	// Meant to be called from the script.
+	void setLateness(int id, duration d) {
+		if (id >= static_cast<int>(lateness.size())) lateness.resize(id + 1);
+		lateness[id] = d;
+	}
+};
+
+thread_local int SimClock::self = 0;
+
+//  -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -
+
+void SimClock::block(std::unique_lock<std::mutex> &lock, time_point wake) {
+	sleepers.push_back({wake, self});
+	running--;
+	// The next thread is woken up with the mutex released,
+	// or it would only wake up to wait for it
+	std::condition_variable *cv = handOver();
+	if (cv) {
+		lock.unlock();
+		cv->notify_one();
+		lock.lock();
+	}
+	cvs[self]->wait(lock, [&] { return turn == self; });
+	turn = -1;
+}
+
+//  -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -
+
+std::condition_variable *SimClock::handOver() {
+	// Passes the turn to the thread due first, once none is running.
+	// Called with the mutex locked, returns what to notify, if anything.
+
+	if (running > 0 || sleepers.empty()) return nullptr;
+	auto next = sleepers.begin();
+	for (auto s = sleepers.begin(); s != sleepers.end(); s++) {
+		if (s->wake < next->wake || (s->wake == next->wake && s->id < next->id))
+			next = s;
+	}
+	while (script && script_at <= next->wake) {
+		if (script_at > t) t = script_at;
+		script_at = script(t);
+	}
+	if (next->wake > t) t = next->wake;
+	turn = next->id;
+	sleepers.erase(next);
+	running = 1;
+	return turn != self ? cvs[turn].get() : nullptr;
+}
+
+//================================== FIXTURES ==================================
+
+// Simulated host, 4 CPUs at USER_HZ of 100
+const int cpus = 4;
+const long jiffies_per_s = 100 * cpus;
+const long mem_total = 1000000;		// [kB]
+
+// Inputs of each part of an hour. PWM thread wakes up late while starved.
+struct Phase {
+	int start;			// [min]
+	float cpu;			// [%], multiple of 1/40 of jiffies_per_s
+	float ram;			// [%]
+	float temp;			// [C]
+	bool starved;
+};
+
+const Phase phases[] = {
+	{ 0, 25, 50, 65, false},
+	{20, 75, 20, 50, false},
+	{40, 60, 80, 80, true},		// fills kept away from LED thresholds
+	{50, 60, 80, 80, false},
+};
+const int phase_count = sizeof(phases) / sizeof(phases[0]);
+
+// Late wakeups of a starved PWM thread
+const std::chrono::microseconds starved_lateness(300);
+
+std::string root;
+
+// Sampler engine the service has run with
+const char *engine = "";
+int stat_fd = -1;
+
+//  -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -
+
+static void writeFile(const std::string &path, const std::string &content) {
+	std::ofstream f(root + path, std::ios::trunc);
+	f << content;
+	if (!f) {
+		std::fprintf(stderr, "Unable to write %s%s\n", root.c_str(), path.c_str());
+		std::exit(2);
+	}
+}
+
+//  -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -
+
+static void writeStat(long busy, long idle) {
+	// CPU time counters (cpu user nice system idle ...), rewritten
+	// in place at a fixed width. Truncating a file on every sample would
+	// make some filesystems flush it to disk each time.
+
+	char line[128];
+	int len = std::snprintf(line, sizeof(line), "cpu  %12ld 0 0 %12ld 0 0 0 0 0 0\n",
+				busy, idle);
+	if (stat_fd == -1) stat_fd = open((root + "/proc/stat").c_str(),
+					  O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+	if (pwrite(stat_fd, line, len, 0) != len) {
+		std::fprintf(stderr, "Unable to write %s/proc/stat\n", root.c_str());
+		std::exit(2);
+	}
+}
+
+//  -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -
+
+static void writeFixtures(const Phase &ph) {
+	// Memory left free and temperature
+
+	long free_kb = static_cast<long>(mem_total * (1 - ph.ram / 100));
+	writeFile("/proc/meminfo", "MemTotal:       " + std::to_string(mem_total) +
+		  " kB\nMemFree:        " + std::to_string(free_kb) +
+		  " kB\nBuffers:        0 kB\nCached:         0 kB\n"
+		  "SReclaimable:   0 kB\n");
+	writeFile("/sys/devices/virtual/thermal/thermal_zone0/temp",
+		  std::to_string(static_cast<long>(ph.temp * 1000)) + "\n");
+}
+
+//================================== CHECKS ====================================
+
+int failures = 0;
+
+// Every latch, for the exact frame check and the run digest
+struct Latch {
+	Clock::time_point t;
+	uint64_t outputs;
+};
+std::vector<Latch> last_latches(16);
+uint64_t latch_count = 0;
+uint64_t digest = 14695981039346656037ull;	// FNV-1a
+
+static void onLatch(const SimChain &chain) {
+	Latch l = {clk->now(), chain.outputs};
+	last_latches[latch_count % last_latches.size()] = l;
+	latch_count++;
+	uint64_t words[2] = {static_cast<uint64_t>(l.t.time_since_epoch().count()),
+			     l.outputs};
+	for (uint64_t w : words) {
+		for (int i = 0; i < 8; i++) {
+			digest ^= (w >> (8 * i)) & 0xff;
+			digest *= 1099511628211ull;
+		}
+	}
+}
+
+//  -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -
+
+static void fail(const std::string &what, const char *format, ...)
+	__attribute__((format(printf, 2, 3)));
+
+static void fail(const std::string &what, const char *format, ...) {
+	va_list args;
+	va_start(args, format);
+	std::fprintf(stderr, "FAIL %s: ", what.c_str());
+	std::vfprintf(stderr, format, args);
+	std::fprintf(stderr, "\n");
+	va_end(args);
+	failures++;
+}
+
+//  -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -
+
+static uint32_t planeDuty(const pwm_data_datatype &planes, int res, int led) {
+	// Reassembles a LED duty from bitplanes
+
+	uint32_t duty = 0;
+	for (int i = 0; i < res; i++) duty |= static_cast<uint32_t>(planes[i] >> led & 1) << i;
+	return duty;
+}
+
+//  -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -
+
+static led_duties_datatype expectedDuties(const PwmParams &p, const Phase &ph) {
+	// Renders the phase inputs straight away, as converged filters would
+
+	bar_fills_datatype fills = {};
+	fills[BAR_CPU] = ph.cpu / 100;
+	fills[BAR_RAM] = ph.ram / 100;
+	fills[BAR_TEMP] = (ph.temp - 40) / 50;
+	return led_pwms(p, fills, 0);
+}
+
+//  -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -
+
+static void checkPwm(const std::string &what, const Phase &ph) {
+	// Frames latched over the last cycle must be the published bitplanes,
+	// identical adjacent ones merged, each shown for exactly its slot.
+	// Nothing may be shifted in but to be latched. Lit time of each
+	// emulated output over the window must match its duty, and duties
+	// must match the inputs of the phase.
+
+	const PwmParams *p = pwm_params_used.load();
+	const int res = p->pwm_res;
+	const uint32_t full = (1u << res) - 1;
+	const pwm_data_datatype planes = pwm_data;
+	const int failed = failures;
+
+	if (pwm_mode.load() != MODE_PWM) {
+		fail(what, "mode is not PWM");
+		return;
+	}
+
+	// Slots of the cycle, the last one merged with the first if they
+	// hold the same plane, as it is not latched again across cycles
+	pwm_schedule_datatype sch = compactSchedule(*p, planes);
+	std::vector<std::pair<uint64_t, Clock::duration>> slots;
+	for (int i = 0; i < sch.slots; i++) slots.push_back({sch.planes[i], sch.periods[i]});
+	if (slots.size() > 1 && slots.front().first == slots.back().first) {
+		slots.front().second += slots.back().second;
+		slots.pop_back();
+	}
+	const int n = slots.size();
+
+	// The last n latches must be all the slots in turn, starting
+	// with any of them. A single slot is never latched again.
+	SimChain chain = simChain();
+	bool matched = n > 1 || chain.latches == 0;
+	std::vector<Latch> cycle;
+	for (int j = n; j > 0 && n > 1; j--) {
+		cycle.push_back(last_latches[(latch_count - j) % last_latches.size()]);
+	}
+	for (int first = 0; n > 1 && first < n; first++) {
+		matched = true;
+		for (int j = 0; j < n && matched; j++) {
+			int q = (first + j) % n;
+			matched = cycle[j].outputs == slots[q].first &&
+				  (j + 1 == n || cycle[j + 1].t - cycle[j].t == slots[q].second);
+		}
+		if (matched) break;
+	}
+	if (!matched) {
+		fail(what, "last %d latches are not the published slots", n);
+		for (int j = 0; j < static_cast<int>(cycle.size()); j++) {
+			std::fprintf(stderr, "  latch %llx at +%lld ns, slot %d %llx\n",
+				     static_cast<unsigned long long>(cycle[j].outputs),
+				     static_cast<long long>((cycle[j].t - cycle[0].t).count()),
+				     j, static_cast<unsigned long long>(slots[j].first));
+		}
+	}
+	// One frame may be shifted in ahead of the latch past the window
+	if (chain.clocks > (chain.latches + 1) * CHAIN_WIDTH) {
+		fail(what, "%llu clocks for %llu latches",
+		     static_cast<unsigned long long>(chain.clocks),
+		     static_cast<unsigned long long>(chain.latches));
+	}
+
+	led_duties_datatype expected = expectedDuties(*p, ph);
+	for (int i = 0; i < CHAIN_WIDTH; i++) {
+		uint32_t duty = planeDuty(planes, res, i);
+		double lit = chain.lit[i] / chain.elapsed;
+		if (std::fabs(lit - static_cast<double>(duty) / full) > 0.0005) {
+			fail(what, "LED %d lit %.5f of the time, duty is %u/%u",
+			     i, lit, duty, full);
+		}
+		if (std::abs(static_cast<int>(duty) - static_cast<int>(expected[i])) > 2) {
+			fail(what, "LED %d duty is %u, expected %u", i, duty, expected[i]);
+		}
+	}
+	if (failures > failed) return;
+	std::printf("ok   %s: %d slots, %llu latches over %.0fs\n", what.c_str(),
+		    n, static_cast<unsigned long long>(chain.latches), chain.elapsed);
+}
+
+//  -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -
+
+static void checkStatic(const std::string &what, const Phase &ph) {
+	// LEDs at or above their static thresholds must have been fully lit
+	// over the window, the others dark, and hardly anything latched
+
+	const PwmParams *p = pwm_params_used.load();
+	const int failed = failures;
+	if (pwm_mode.load() != MODE_STATIC) {
+		fail(what, "mode is not static");
+		return;
+	}
+	SimChain chain = simChain();
+	led_duties_datatype expected = expectedDuties(*p, ph);
+	uint64_t mask = 0;
+	for (int i = 0; i < CHAIN_WIDTH; i++) {
+		if (expected[i] >= p->static_threshold[i]) mask |= 1ull << i;
+		double lit = chain.lit[i] / chain.elapsed;
+		double want = (mask >> i) & 1;
+		if (lit != want) fail(what, "LED %d lit %.5f of the time", i, lit);
+	}
+	if (chain.outputs != mask) {
+		fail(what, "outputs are %llx, expected %llx",
+		     static_cast<unsigned long long>(chain.outputs),
+		     static_cast<unsigned long long>(mask));
+	}
+	if (chain.latches > 2) {
+		fail(what, "%llu latches of an unchanged frame",
+		     static_cast<unsigned long long>(chain.latches));
+	}
+	if (failures > failed) return;
+	std::printf("ok   %s: outputs %llx, %llu latches over %.0fs\n", what.c_str(),
+		    static_cast<unsigned long long>(chain.outputs),
+		    static_cast<unsigned long long>(chain.latches), chain.elapsed);
+}
+
+//=================================== SCRIPT ===================================
+
+class Script {
+	// Advances fixtures every sample period, switches phases,
+	// and checks the last minute of each phase.
+	// Sampling must slow down to sample_min_rate within a phase, and
+	// a phase changing measurements must be sampled within the interval
+	// of that rate.
+
+	private:
+	SimClock &sim;
+	Clock::time_point start;
+	Clock::time_point end;
+	long busy = 0;
+	long idle = 0;
+	int phase = -1;
+	uint64_t window_samples = 0;		// at the start of the last minute
+	uint64_t change_samples = 0;		// at the last change
+	Clock::time_point changed;
+	bool pending = false;			// change not sampled yet
+
+	public:
+	std::chrono::duration<double> response{0};	// longest so far
+
+	Script(SimClock &sim, Clock::time_point start, int hours) :
+		sim(sim), start(start), end(start + std::chrono::hours(hours)) {}
+
+	Clock::time_point operator()(Clock::time_point now) {
+		const auto tick = 500ms;
+		auto in_hour = (now - start) % std::chrono::hours(1);
+		int minute = std::chrono::duration_cast<std::chrono::minutes>(in_hour).count();
+		int hour = std::chrono::duration_cast<std::chrono::hours>(now - start).count();
+		int ph = 0;
+		while (ph + 1 < phase_count && phases[ph + 1].start <= minute) ph++;
+
+		// The last minute of a phase is checked as it ends
+		auto to_end = (ph + 1 < phase_count ? phases[ph + 1].start : 60) *
+			      std::chrono::minutes(1) - in_hour;
+		if (to_end == 1min) {
+			simReset();
+			window_samples = pacer.samples();
+		}
+		if ((ph != phase || now >= end) && phase >= 0) {
+			std::string what = "hour " + std::to_string(hour - (ph == 0)) +
+					   ", phase " + std::to_string(phase);
+			if (phases[phase].starved) checkStatic(what, phases[phase]);
+			else checkPwm(what, phases[phase]);
+			uint64_t n = pacer.samples() - window_samples;
+			if (n > 60 * cfg.sample_min_rate + 1) {
+				fail(what, "%llu samples in the last minute",
+				     static_cast<unsigned long long>(n));
+			}
+		}
+		if (now >= end) {
+			main_closing = 1;
+			return Clock::time_point::max();
+		}
+		if (pending && pacer.samples() > change_samples) {
+			std::chrono::duration<double> r = now - changed;
+			response = std::max(response, r);
+			pending = false;
+			if (r.count() > 1 / cfg.sample_min_rate + 0.5) {
+				fail("phase " + std::to_string(phase), "change sampled "
+				     "after %.1fs", r.count());
+			}
+			if (pacer.div() != cfg.ref_div) {
+				fail("phase " + std::to_string(phase), "sampling not back "
+				     "to full rate after a change");
+			}
+		}
+		if (ph != phase) {
+			const Phase &prev = phases[phase < 0 ? 0 : phase];
+			if (phase >= 0 && (prev.cpu != phases[ph].cpu ||
+			    prev.ram != phases[ph].ram || prev.temp != phases[ph].temp)) {
+				changed = now;
+				change_samples = pacer.samples();
+				pending = true;
+			}
+			sim.setLateness(1, phases[ph].starved ? starved_lateness :
+					   std::chrono::microseconds(0));
+			writeFixtures(phases[ph]);
+			engine = sampler.engine();
+			phase = ph;
+		}
+
+		const Phase &p = phases[ph];
+		long ticks = jiffies_per_s * tick.count() / 1000;
+		long b = static_cast<long>(std::lround(ticks * p.cpu / 100));
+		busy += b;
+		idle += ticks - b;
+		writeStat(busy, idle);
+		return now + tick;
+	}
+};
+
+//================================= FAN SCENARIO ===============================
+
+// Load of each part of an hour of the fan scenario [%]
+struct FanPhase {
+	int start;			// [min]
+	float cpu;			// [%], multiple of 1/40 of jiffies_per_s
+};
+
+const FanPhase fan_phases[] = {
+	{ 0,   5},
+	{20, 100},
+	{40,   5},
+};
+const int fan_phase_count = sizeof(fan_phases) / sizeof(fan_phases[0]);
+
+// Thermal model of the SoC and its heatsink: a single heat capacity,
+// cooled by natural convection and by the fan. At full load it would
+// settle 75K above ambient with no fan, and 30K with the fan at full speed.
+const float ambient = 25;			// [C]
+const float heat_capacity = 15;			// [J/K]
+const float idle_power = 1.5;			// [W]
+const float load_power = 4.5;			// [W] more at full load
+const float passive_conductance = 0.08;		// [W/K]
+const float fan_conductance = 0.12;		// [W/K] more at full speed
+
+// A stopped fan spins up at no less duty, a spinning one stalls below
+const float fan_start_duty = 0.6;
+const float fan_stall_duty = 0.2;
+
+// SoC throttles at this temperature [C]
+const float throttle_temp = 80;
+
+// Fan configs of even hours (PI control) and odd ones (curve).
+// The curve one leaves out keys the PI one sets, which must go back to
+// their defaults once it is reloaded.
+const char *fan_configs[] = {
+	"fan = 2\nfan_target = 63\nfan_hysteresis = 2\nfan_min_duty = 30\nfan_kick = 1\n",
+	"fan = 1\nfan_curve = 55:0 60:30 70:60 80:100\n",
+};
+const char *base_config = "governor = 0\nstats_interval = 0\nio_uring = 1\nsample_psi =\n"
+			  "fallback_probe_interval = 600\nadaptive_sampling = 1\n";
+
+int temp_fd = -1;
+
+// Fan kicks, followed on every latch
+Clock::time_point kick_start;
+uint64_t kick_starts = 0;
+bool kicking = false;
+float kick_longest = 0;		// [s] in the current phase
+
+//  -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -
+
+static void writeTemp(float t) {
+	// Rewritten in place as well, zero padded to a fixed width
+
+	char line[32];
+	int len = std::snprintf(line, sizeof(line), "%07ld\n", std::lround(t * 1000));
+	if (temp_fd == -1) temp_fd = open((root + "/sys/devices/virtual/thermal/"
+					  "thermal_zone0/temp").c_str(),
+					  O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+	if (pwrite(temp_fd, line, len, 0) != len) {
+		std::fprintf(stderr, "Unable to write temperature\n");
+		std::exit(2);
+	}
+}
+
+//  -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -
+
+static void onFanLatch(const SimChain &) {
+	// A kick lasts from a spin-up until the controller lets go of full
+	// duty, which it may only do on a refresh cycle
+
+	auto now = clk->now();
+	if (fan.starts() != kick_starts) {
+		kick_starts = fan.starts();
+		kick_start = now;
+		kicking = true;
+	}
+	if (kicking && (fan.duty() < 100 || !fan.running())) {
+		float len = std::chrono::duration<float>(now - kick_start).count();
+		kick_longest = std::max(kick_longest, len);
+		kicking = false;
+	}
+}
+
+//  -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -
+
+class FanScript {
+	// Runs the thermal model every tick, with the airflow of the fan
+	// driven through the emulated fan pin since the last tick.
+	// Even hours run PI control, odd ones the curve, switched by
+	// rewriting the config file. Each phase is checked as it ends.
+
+	private:
+	SimClock &sim;
+	Clock::time_point start;
+	Clock::time_point end;
+	long busy = 0;
+	long idle = 0;
+	int phase = -1;
+	int hour = 0;
+
+	float temp = ambient + (idle_power + load_power * 0.05f) / passive_conductance;
+	bool spinning = false;
+	float duty = 0;			// fan pin duty since the last tick
+	double last_fan = 0;		// fan pin high time at the last tick [s]
+	double last_elapsed = 0;
+	Clock::time_point running_since;
+	bool was_running = false;
+
+	// Over the run, the phase, and its last 5 minutes
+	float run_peak = 0;
+	float peak = 0;
+	float settled_min = 1000, settled_max = 0;
+	double settled_sum = 0;
+	int settled_n = 0;
+	// Commanded duty over the last minute, against the fan pin
+	double commanded = 0;
+	int commanded_n = 0;
+	int stalls = 0;
+	int loads = 0;
+
+	void check(const std::string &what, bool load, int mode);
+
+	public:
+	FanScript(SimClock &sim, Clock::time_point start, int hours) :
+		sim(sim), start(start), end(start + std::chrono::hours(hours)) {}
+
+	float peakTemp() const { return run_peak; }
+
+	Clock::time_point operator()(Clock::time_point now);
+};
+
+//  -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -
+
+void FanScript::check(const std::string &what, bool load, int mode) {
+	// Under load the fan keeps the SoC off its throttling point and
+	// settles it, at fan_target with PI control. Once idle, it stops.
+	// Keys removed from the config by the curve one are back at defaults.
+	// The fan pin must follow the controller all along, every spin-up
+	// must take, and there must be no more spin-ups than loads.
+	// A kick must not outlast fan_kick by more than a refresh period,
+	// however slowly the sampling goes.
+
+	const int failed = failures;
+	SimChain chain = simChain();
+	double pin = chain.elapsed > 0 ? chain.fan / chain.elapsed : 0;
+	double want = commanded_n ? commanded / commanded_n : 0;
+	float mean = settled_n ? settled_sum / settled_n : 0;
+
+	if (std::fabs(pin - want) > 0.02)
+		fail(what, "fan pin high %.3f of the time, commanded %.3f", pin, want);
+	if (stalls) fail(what, "fan stalled for %d ticks while driven", stalls);
+	if (kick_longest > cfg.fan_kick + 1 / cfg.refresh_rate + 0.01f)
+		fail(what, "fan kicked for %.2fs, fan_kick %.1fs", kick_longest,
+		     cfg.fan_kick);
+	if (fan.starts() != static_cast<uint64_t>(loads))
+		fail(what, "%llu spin-ups over %d loads",
+		     static_cast<unsigned long long>(fan.starts()), loads);
+	if (load) {
+		if (peak >= throttle_temp) fail(what, "peak temperature %.1fC", peak);
+		if (!fan.running()) fail(what, "fan not running");
+		if (settled_max - settled_min > 2)
+			fail(what, "temperature swinging %.1f-%.1fC", settled_min, settled_max);
+		if (mode == 2 && std::fabs(mean - cfg.fan_target) > 1)
+			fail(what, "temperature %.2fC, target %.0fC", mean, cfg.fan_target);
+	} else {
+		if (fan.running() || chain.fan > 0) fail(what, "fan not stopped");
+	}
+	const Config defaults;
+	if (mode == 1 && (cfg.fan_target != defaults.fan_target ||
+			  cfg.fan_hysteresis != defaults.fan_hysteresis)) {
+		fail(what, "fan_target %.0f, fan_hysteresis %.0f kept after removal "
+		     "from the config", cfg.fan_target, cfg.fan_hysteresis);
+	}
+	if (failures > failed) return;
+	std::printf("ok   %s: %s, peak %.1fC, settled at %.1fC, fan %.1f%%, "
+		    "%llu spin-ups\n", what.c_str(), mode == 2 ? "PI" : "curve",
+		    peak, mean, 100 * pin,
+		    static_cast<unsigned long long>(fan.starts()));
+}
+
+//  -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -
+
+Clock::time_point FanScript::operator()(Clock::time_point now) {
+	const auto tick = 500ms;
+	const float dt = std::chrono::duration<float>(tick).count();
+	auto in_hour = (now - start) % std::chrono::hours(1);
+	int minute = std::chrono::duration_cast<std::chrono::minutes>(in_hour).count();
+	int h = std::chrono::duration_cast<std::chrono::hours>(now - start).count();
+	int ph = 0;
+	while (ph + 1 < fan_phase_count && fan_phases[ph + 1].start <= minute) ph++;
+
+	auto to_end = (ph + 1 < fan_phase_count ? fan_phases[ph + 1].start : 60) *
+		      std::chrono::minutes(1) - in_hour;
+	if ((ph != phase || now >= end) && phase >= 0) {
+		std::string what = "hour " + std::to_string(hour) +
+				   ", phase " + std::to_string(phase);
+		check(what, fan_phases[phase].cpu > 50, hour % 2 ? 1 : 2);
+	}
+	if (now >= end) {
+		main_closing = 1;
+		return Clock::time_point::max();
+	}
+	if (ph != phase) {
+		if (h != hour) {
+			writeFile("/pistackmond.conf", std::string(base_config) +
+				  fan_configs[h % 2]);
+			hour = h;
+		}
+		if (fan_phases[ph].cpu > 50) loads++;
+		phase = ph;
+		peak = 0;
+		settled_min = 1000;
+		settled_max = 0;
+		settled_sum = 0;
+		settled_n = 0;
+		stalls = 0;
+		kick_longest = 0;
+	}
+	if (to_end == 1min) {
+		simReset();
+		last_fan = last_elapsed = 0;
+		commanded = 0;
+		commanded_n = 0;
+	}
+
+	// Airflow from the fan pin since the last tick
+	SimChain chain = simChain();
+	// Right after simReset() there is none, so it stays as it was.
+	double span = chain.elapsed - last_elapsed;
+	if (span > 0) duty = (chain.fan - last_fan) / span;
+	last_fan = chain.fan;
+	last_elapsed = chain.elapsed;
+	if (!spinning && duty >= fan_start_duty) spinning = true;
+	else if (spinning && duty < fan_stall_duty) spinning = false;
+	float airflow = spinning ? duty : 0;
+
+	// A fan driven for longer than its kick must be spinning
+	if (fan.running() && !was_running) running_since = now;
+	was_running = fan.running();
+	auto kick = std::chrono::duration<float>(cfg.fan_kick + 1);
+	if (fan.running() && now - running_since > kick && !spinning) stalls++;
+
+	const FanPhase &p = fan_phases[ph];
+	float power = idle_power + load_power * p.cpu / 100;
+	float conductance = passive_conductance + fan_conductance * airflow;
+	temp += dt / heat_capacity * (power - conductance * (temp - ambient));
+	writeTemp(temp);
+
+	peak = std::max(peak, temp);
+	run_peak = std::max(run_peak, temp);
+	if (to_end <= 5min) {
+		settled_min = std::min(settled_min, temp);
+		settled_max = std::max(settled_max, temp);
+		settled_sum += temp;
+		settled_n++;
+	}
+	commanded += fan.duty() / 100;
+	commanded_n++;
+
+	long ticks = jiffies_per_s * tick.count() / 1000;
+	long b = static_cast<long>(std::lround(ticks * p.cpu / 100));
+	busy += b;
+	idle += ticks - b;
+	writeStat(busy, idle);
+	return now + tick;
+}
+
+// =================================== MAIN ====================================
+
+int main(int argc, char *argv[]) {
+	// "fan" runs the fan scenario instead of the LED one
+	bool fan_run = argc > 1 && std::string(argv[1]) == "fan";
+	int hours = argc > 1 + fan_run ? std::atoi(argv[1 + fan_run]) : 2;
+	if (hours < 1) {
+		std::fprintf(stderr, "usage: %s [fan] [HOURS]\n", argv[0]);
+		return 3;
+	}
+
+	// Fixture tree, config and shared memory names of this run only
+	char dir[] = "/tmp/pistackmond-sim-XXXXXX";
+	if (!mkdtemp(dir)) {
+		perror("mkdtemp failed");
+		return 2;
+	}
+	root = dir;
+	for (const char *d : {"/proc", "/sys", "/sys/devices", "/sys/devices/virtual",
+			      "/sys/devices/virtual/thermal",
+			      "/sys/devices/virtual/thermal/thermal_zone0"}) {
+		mkdir((root + d).c_str(), 0755);
+	}
+	writeFile("/proc/loadavg", "1.00 1.00 1.00 1/100 1\n");
+	writeFile("/pistackmond.conf", std::string(base_config) +
+		  (fan_run ? fan_configs[0] : ""));
+	std::string id = std::to_string(getpid());
+	shr_mem_path = "/pistackmond-sim-" + id;
+	stats_path = "/pistackmond-sim-stats-" + id;
+	fs_root = root;
+	config_path = root + "/pistackmond.conf";
+	std::string err;
+	if (!loadConfig(config_path, base_cfg, cfg, err)) {
+		std::fprintf(stderr, "error: %s\n", err.c_str());
+		return 2;
+	}
+
+	auto start = Clock::time_point(std::chrono::hours(24));
+	SimClock sim(start);
+	Script script(sim, start, hours);
+	FanScript fan_script(sim, start, hours);
+	writeStat(0, 0);
+	writeFixtures(phases[0]);
+	if (fan_run) sim.setScript(std::ref(fan_script), start);
+	else sim.setScript(std::ref(script), start);
+	clk = &sim;
+	simLatchHook = fan_run ? onFanLatch : onLatch;
+
+	auto wall = std::chrono::steady_clock::now();
+	service(start);
+	double wall_s = std::chrono::duration<double>(
+			std::chrono::steady_clock::now() - wall).count();
+	close(stat_fd);
+	if (temp_fd != -1) close(temp_fd);
+
+	for (const char *f : {"/proc/stat", "/proc/meminfo", "/proc/loadavg",
+			      "/sys/devices/virtual/thermal/thermal_zone0/temp",
+			      "/pistackmond.conf"}) {
+		unlink((root + f).c_str());
+	}
+	for (const char *d : {"/sys/devices/virtual/thermal/thermal_zone0",
+			      "/sys/devices/virtual/thermal", "/sys/devices/virtual",
+			      "/sys/devices", "/sys", "/proc", ""}) {
+		rmdir((root + d).c_str());
+	}
+
+	if (fan_run) {
+		std::printf("%d simulated hours in %.2fs (%.0fx), %llu fan spin-ups, "
+			    "peak %.1fC\n", hours, wall_s, hours * 3600 / wall_s,
+			    static_cast<unsigned long long>(fan.starts()),
+			    fan_script.peakTemp());
+	} else {
+		std::printf("%d simulated hours in %.2fs (%.0fx), %llu latches (%.0f/s), "
+			    "sampled with %s, %.0f samples/h, response %.1fs, "
+			    "digest %016llx\n", hours, wall_s, hours * 3600 / wall_s,
+			    static_cast<unsigned long long>(latch_count),
+			    latch_count / wall_s, engine,
+			    static_cast<double>(pacer.samples()) / hours,
+			    script.response.count(),
+			    static_cast<unsigned long long>(digest));
+	}
+	if (failures) {
+		std::printf("%d checks failed\n", failures);
+		return 1;
+	}
+	std::printf("all checks passed\n");
+	return 0;
+}
@@ -0,0 +1,97 @@
+// -------------------------------------------------------------------------
+// PWM supervisor
+//
+// supervisor.cpp: falls back to static LEDs when PWM deadlines are missed
+//
+// Website: https://github.com/tomek-szczesny/pistackmon
+// Authors: Tomek Szczesny, Bernhard Bablok
+// License: GPL3
+// -------------------------------------------------------------------------
+
+#include "supervisor.h"
+
+void PwmSupervisor::advance(const FallbackSettings &s,
+			    std::chrono::steady_clock::time_point now) {
+	// Moves to the bucket covering now, emptying the ones skipped over.
+	// After a long gap the whole window is emptied.
+
+	auto span = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+			s.window / SUPERVISOR_BUCKETS);
+	if (!started) {
+		started = true;
+		bucket_end = now + span;
+		return;
+	}
+	for (int i = 0; now >= bucket_end && i < SUPERVISOR_BUCKETS; i++) {
+		bucket = (bucket + 1) % SUPERVISOR_BUCKETS;
+		buckets[bucket] = Bucket();
+		bucket_end += span;
+	}
+	if (now >= bucket_end) bucket_end = now + span;
+}
+
+//  -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -
+
+void PwmSupervisor::clear() {
+	for (auto &b : buckets) b = Bucket();
+}
+
+//  -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -
+
+float PwmSupervisor::missRatio() const {
+	uint64_t slots = 0, missed = 0;
+	for (const auto &b : buckets) {
+		slots += b.slots;
+		missed += b.missed;
+	}
+	return slots ? 100.0f * missed / slots : 0;
+}
+
+//  -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -   -
+
+bool PwmSupervisor::update(const FallbackSettings &s, uint64_t slots,
+			   uint64_t missed,
+			   std::chrono::steady_clock::time_point now) {
+
+	if (!s.enabled) {
+		bool changed = (md != MODE_PWM);
+		md = MODE_PWM;
+		probe = false;
+		return changed;
+	}
+
+	advance(s, now);
+	buckets[bucket].slots += slots;
+	buckets[bucket].missed += missed;
+
+	if (md == MODE_STATIC) {
+		if (now < probe_at) return false;
+		md = MODE_PWM;
+		probe = true;
+		probe_at = now + std::chrono::duration_cast<
+			std::chrono::steady_clock::duration>(s.probe_time);
+		probe_count++;
+		clear();
+		return true;
+	}
+
+	uint64_t total = 0;
+	for (const auto &b : buckets) total += b.slots;
+	float ratio = missRatio();
+
+	if (probe) {
+		// A probe is judged only once it is over, against the lower
+		// threshold, so a borderline host does not keep switching
+		if (now < probe_at) return false;
+		probe = false;
+		if (total >= SUPERVISOR_MIN_SLOTS && ratio <= s.miss_low) return false;
+	} else if (total < SUPERVISOR_MIN_SLOTS || ratio <= s.miss_high) {
+		return false;
+	}
+
+	md = MODE_STATIC;
+	probe_at = now + std::chrono::duration_cast<
+		std::chrono::steady_clock::duration>(s.probe_interval);
+	fallback_count++;
+	return true;
+}
@@ -0,0 +1,86 @@
+// -------------------------------------------------------------------------
+// PWM supervisor
+//
+// supervisor.h: falls back to static LEDs when PWM deadlines are missed
+//
+// Website: https://github.com/tomek-szczesny/pistackmon
+// Authors: Tomek Szczesny, Bernhard Bablok
+// License: GPL3
+// -------------------------------------------------------------------------
+
+#ifndef _SUPERVISOR_H
+#define _SUPERVISOR_H
+
+#include <chrono>
+#include <cstdint>
+
+// Window of deadline misses is kept in this many buckets
+#define SUPERVISOR_BUCKETS 8
+
+// Fewer slots than this in the window are not enough to judge
+#define SUPERVISOR_MIN_SLOTS 64
+
+enum PwmMode {
+	MODE_PWM,		// binary code modulation
+	MODE_STATIC		// thresholded on/off frames, latched on change
+};
+
+struct FallbackSettings {
+	bool enabled = true;
+	std::chrono::duration<float> window{2};		// sliding window
+	float miss_high = 20;				// [% of slots]
+	float miss_low = 5;				// [% of slots]
+	std::chrono::duration<float> probe_interval{60};
+	std::chrono::duration<float> probe_time{2};
+};
+
+class PwmSupervisor {
+	// Without real time priority, or with a starved CPU, the PWM thread
+	// misses its slot deadlines. Brightness goes wrong, LEDs flicker,
+	// and CPU time is burnt for nothing.
+	// PwmSupervisor counts slots started late over a sliding window, and
+	// switches to static mode once their share exceeds miss_high.
+	// Every probe_interval it switches back to PWM for probe_time, and
+	// stays there if the share is no more than miss_low by then.
+	// Time is always given by the caller, so it can be simulated.
+
+	private:
+	struct Bucket {
+		uint64_t slots = 0;
+		uint64_t missed = 0;
+	} buckets[SUPERVISOR_BUCKETS];
+	int bucket = 0;
+	std::chrono::steady_clock::time_point bucket_end;
+	bool started = false;
+
+	PwmMode md = MODE_PWM;
+	bool probe = false;
+	std::chrono::steady_clock::time_point probe_at;	// next probe, or its end
+
+	uint64_t fallback_count = 0;
+	uint64_t probe_count = 0;
+
+	void advance(const FallbackSettings &s,
+		     std::chrono::steady_clock::time_point now);
+	void clear();
+
+	public:
+
+	// Accounts a PWM cycle (slots executed, of which missed started late),
+	// or a static refresh (no slots).
+	// Returns true if the mode has changed.
+	bool update(const FallbackSettings &s, uint64_t slots, uint64_t missed,
+		    std::chrono::steady_clock::time_point now);
+
+	PwmMode mode() const { return md; }
+	bool probing() const { return probe; }
+
+	// Share of slots started late over the window [%]
+	float missRatio() const;
+
+	// Switches to static mode and probes taken so far
+	uint64_t fallbacks() const { return fallback_count; }
+	uint64_t probes() const { return probe_count; }
+};
+
+#endif